@@ -0,0 +1,318 @@
+#include "avi_chunk_index.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define AVI_CHUNK_INDEX_INITIAL_DATA_SIZE (4 * 1024)
+#define AVI_CHUNK_INDEX_INITIAL_BLOCK_NUM (64)
+
+typedef struct {
+    uint64_t offset;    // File offset of the first chunk
+    uint64_t position;  // Stream position of the first chunk
+    uint32_t data;      // Start of the encoded entries in data
+    uint32_t size;      // Size of the first chunk
+} block_t;
+
+struct avi_chunk_index {
+    uint32_t count;
+    block_t *blocks;
+    uint32_t block_capacity;
+    uint8_t *data;
+    uint32_t data_size;
+    uint32_t data_capacity;
+    // Last appended chunk, base of the next delta
+    uint64_t last_offset;
+    uint32_t last_size;
+    uint64_t total_size;    // Stream position of the next chunk
+};
+
+typedef struct {
+    uint32_t count;
+    uint32_t block_count;
+    uint32_t data_size;
+} serialized_header_t;
+
+static inline uint64_t zigzag_encode(int64_t value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+static inline int64_t zigzag_decode(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+
+static inline uint8_t *varint_write(uint8_t *p, uint64_t value) {
+    while (value >= 0x80) {
+        *p++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+static inline const uint8_t *varint_read(const uint8_t *p, uint64_t *value) {
+    uint64_t result = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        result |= (uint64_t)(*p++ & 0x7F) << shift;
+        shift += 7;
+    }
+    *value = result | ((uint64_t)*p++ << shift);
+    return p;
+}
+
+// Bounds-checked step over one varint (10 bytes at most for 64 bits), for data read from a file
+static inline bool varint_skip(const uint8_t **p, const uint8_t *end) {
+    for (int i = 0; i < 10 && *p < end; i++) {
+        if (!(*(*p)++ & 0x80)) return true;
+    }
+    return false;
+}
+
+// Chunk headers are 8 bytes and payloads are padded to an even size
+static inline uint64_t chunk_end(uint64_t offset, uint32_t size) {
+    return offset + 8 + size + (size & 1);
+}
+
+static bool reserve(void **buffer, uint32_t *capacity, uint32_t required, uint32_t initial_capacity, size_t element_size) {
+    if (required <= *capacity) return true;
+    uint32_t new_capacity = *capacity ? *capacity : initial_capacity;
+    while (new_capacity < required) new_capacity *= 2;
+    void *new_buffer = realloc(*buffer, (size_t)new_capacity * element_size);
+    if (!new_buffer) return false;
+    *buffer = new_buffer;
+    *capacity = new_capacity;
+    return true;
+}
+
+avi_chunk_index_t *avi_chunk_index_create(void) {
+    return calloc(1, sizeof(avi_chunk_index_t));
+}
+
+void avi_chunk_index_delete(avi_chunk_index_t *index) {
+    if (!index) return;
+    free(index->blocks);
+    free(index->data);
+    free(index);
+}
+
+bool avi_chunk_index_append(avi_chunk_index_t *index, uint64_t offset, uint32_t size, bool keyframe) {
+    // Gap and size varints, 10 bytes each at most
+    if (!reserve((void **)&index->data, &index->data_capacity, index->data_size + 20, AVI_CHUNK_INDEX_INITIAL_DATA_SIZE, 1)) {
+        return false;
+    }
+    uint8_t *p = index->data + index->data_size;
+    int64_t size_delta;
+    if (index->count % AVI_CHUNK_INDEX_BLOCK_SIZE == 0) {
+        uint32_t block_count = index->count / AVI_CHUNK_INDEX_BLOCK_SIZE + 1;
+        if (!reserve((void **)&index->blocks, &index->block_capacity, block_count, AVI_CHUNK_INDEX_INITIAL_BLOCK_NUM, sizeof(block_t))) {
+            return false;
+        }
+        block_t *block = &index->blocks[block_count - 1];
+        block->offset = offset;
+        block->position = index->total_size;
+        block->data = index->data_size;
+        block->size = size;
+        size_delta = 0;
+    } else {
+        p = varint_write(p, zigzag_encode((int64_t)offset - (int64_t)chunk_end(index->last_offset, index->last_size)));
+        size_delta = (int64_t)size - index->last_size;
+    }
+    p = varint_write(p, zigzag_encode(size_delta) << 1 | keyframe);
+    index->data_size = p - index->data;
+    index->last_offset = offset;
+    index->last_size = size;
+    index->total_size += size;
+    index->count++;
+    return true;
+}
+
+uint32_t avi_chunk_index_count(const avi_chunk_index_t *index) {
+    return index->count;
+}
+
+// Decodes the entries of a block in order
+typedef struct {
+    const uint8_t *p;
+    uint32_t remaining;
+    avi_chunk_t chunk;
+} block_reader_t;
+
+static void block_reader_init(const avi_chunk_index_t *index, uint32_t block_number, block_reader_t *reader) {
+    const block_t *block = &index->blocks[block_number];
+    uint64_t value;
+    reader->p = varint_read(index->data + block->data, &value);
+    reader->remaining = index->count - block_number * AVI_CHUNK_INDEX_BLOCK_SIZE - 1;
+    if (reader->remaining > AVI_CHUNK_INDEX_BLOCK_SIZE - 1) reader->remaining = AVI_CHUNK_INDEX_BLOCK_SIZE - 1;
+    reader->chunk.offset = block->offset;
+    reader->chunk.size = block->size;
+    reader->chunk.keyframe = value & 1;
+    reader->chunk.position = block->position;
+}
+
+static bool block_reader_next(block_reader_t *reader) {
+    if (reader->remaining == 0) return false;
+    uint64_t gap, value;
+    reader->p = varint_read(reader->p, &gap);
+    reader->p = varint_read(reader->p, &value);
+    avi_chunk_t *chunk = &reader->chunk;
+    chunk->position += chunk->size;
+    chunk->offset = chunk_end(chunk->offset, chunk->size) + zigzag_decode(gap);
+    chunk->size += zigzag_decode(value >> 1);
+    chunk->keyframe = value & 1;
+    reader->remaining--;
+    return true;
+}
+
+bool avi_chunk_index_get(const avi_chunk_index_t *index, uint32_t number, avi_chunk_t *chunk) {
+    if (number >= index->count) return false;
+    block_reader_t reader;
+    block_reader_init(index, number / AVI_CHUNK_INDEX_BLOCK_SIZE, &reader);
+    for (uint32_t i = number % AVI_CHUNK_INDEX_BLOCK_SIZE; i > 0; i--) block_reader_next(&reader);
+    *chunk = reader.chunk;
+    return true;
+}
+
+uint32_t avi_chunk_index_find_offset(const avi_chunk_index_t *index, uint64_t offset) {
+    // Last block starting at or before the offset
+    uint32_t block_count = (index->count + AVI_CHUNK_INDEX_BLOCK_SIZE - 1) / AVI_CHUNK_INDEX_BLOCK_SIZE;
+    if (block_count == 0 || offset <= index->blocks[0].offset) return 0;
+    uint32_t low = 0, high = block_count;
+    while (high - low > 1) {
+        uint32_t middle = (low + high) / 2;
+        if (index->blocks[middle].offset <= offset) low = middle;
+        else high = middle;
+    }
+    block_reader_t reader;
+    block_reader_init(index, low, &reader);
+    uint32_t number = low * AVI_CHUNK_INDEX_BLOCK_SIZE;
+    while (reader.chunk.offset < offset) {
+        number++;
+        if (!block_reader_next(&reader)) break;
+    }
+    return number;
+}
+
+uint32_t avi_chunk_index_find_keyframe(const avi_chunk_index_t *index, uint32_t number) {
+    if (index->count == 0) return 0;
+    if (number >= index->count) number = index->count - 1;
+    // Walk back block by block, each block is decoded forward up to its last candidate
+    for (int64_t block = number / AVI_CHUNK_INDEX_BLOCK_SIZE; block >= 0; block--) {
+        uint32_t first = block * AVI_CHUNK_INDEX_BLOCK_SIZE;
+        uint32_t last = number < first + AVI_CHUNK_INDEX_BLOCK_SIZE - 1 ? number : first + AVI_CHUNK_INDEX_BLOCK_SIZE - 1;
+        block_reader_t reader;
+        block_reader_init(index, block, &reader);
+        int64_t keyframe = -1;
+        for (uint32_t i = first; ; i++) {
+            if (reader.chunk.keyframe) keyframe = i;
+            if (i == last || !block_reader_next(&reader)) break;
+        }
+        if (keyframe >= 0) return keyframe;
+    }
+    return 0;
+}
+
+bool avi_chunk_index_find_position(const avi_chunk_index_t *index, uint64_t position, uint32_t *number, avi_chunk_t *chunk) {
+    if (position >= index->total_size) return false;
+    uint32_t block_count = (index->count + AVI_CHUNK_INDEX_BLOCK_SIZE - 1) / AVI_CHUNK_INDEX_BLOCK_SIZE;
+    uint32_t low = 0, high = block_count;
+    while (high - low > 1) {
+        uint32_t middle = (low + high) / 2;
+        if (index->blocks[middle].position <= position) low = middle;
+        else high = middle;
+    }
+    block_reader_t reader;
+    block_reader_init(index, low, &reader);
+    *number = low * AVI_CHUNK_INDEX_BLOCK_SIZE;
+    while (reader.chunk.position + reader.chunk.size <= position && block_reader_next(&reader)) (*number)++;
+    *chunk = reader.chunk;
+    return true;
+}
+
+size_t avi_chunk_index_memory_size(const avi_chunk_index_t *index) {
+    return sizeof(avi_chunk_index_t) + (size_t)index->block_capacity * sizeof(block_t) + index->data_capacity;
+}
+
+void avi_chunk_index_trim(avi_chunk_index_t *index) {
+    uint32_t block_count = (index->count + AVI_CHUNK_INDEX_BLOCK_SIZE - 1) / AVI_CHUNK_INDEX_BLOCK_SIZE;
+    if (block_count > 0 && block_count < index->block_capacity) {
+        block_t *blocks = realloc(index->blocks, block_count * sizeof(block_t));
+        if (blocks) {
+            index->blocks = blocks;
+            index->block_capacity = block_count;
+        }
+    }
+    if (index->data_size > 0 && index->data_size < index->data_capacity) {
+        uint8_t *data = realloc(index->data, index->data_size);
+        if (data) {
+            index->data = data;
+            index->data_capacity = index->data_size;
+        }
+    }
+}
+
+bool avi_chunk_index_write(const avi_chunk_index_t *index, int fd) {
+    serialized_header_t header = {
+        .count = index->count,
+        .block_count = (index->count + AVI_CHUNK_INDEX_BLOCK_SIZE - 1) / AVI_CHUNK_INDEX_BLOCK_SIZE,
+        .data_size = index->data_size,
+    };
+    size_t blocks_size = header.block_count * sizeof(block_t);
+    return write(fd, &header, sizeof(header)) == sizeof(header) &&
+           (blocks_size == 0 || write(fd, index->blocks, blocks_size) == (ssize_t)blocks_size) &&
+           (header.data_size == 0 || write(fd, index->data, header.data_size) == (ssize_t)header.data_size);
+}
+
+// Every entry has to decode within data, lookups decode without bounds checks
+static bool entries_in_bounds(const avi_chunk_index_t *index, uint32_t block_count) {
+    const uint8_t *end = index->data + index->data_size;
+    for (uint32_t block = 0; block < block_count; block++) {
+        if (index->blocks[block].data >= index->data_size) return false;
+        const uint8_t *p = index->data + index->blocks[block].data;
+        uint32_t entries = index->count - block * AVI_CHUNK_INDEX_BLOCK_SIZE;
+        if (entries > AVI_CHUNK_INDEX_BLOCK_SIZE) entries = AVI_CHUNK_INDEX_BLOCK_SIZE;
+        // The first entry of a block has only the size varint, the others the gap as well
+        for (uint32_t i = 0; i < entries * 2 - 1; i++) {
+            if (!varint_skip(&p, end)) return false;
+        }
+    }
+    return true;
+}
+
+avi_chunk_index_t *avi_chunk_index_read(int fd) {
+    serialized_header_t header;
+    if (read(fd, &header, sizeof(header)) != sizeof(header)) return NULL;
+    // Counts from the file: the blocks and the data have to be in the rest of it, which also keeps
+    // their sizes from wrapping around on 32 bits
+    struct stat st;
+    off_t position = lseek(fd, 0, SEEK_CUR);
+    uint64_t blocks_size = (uint64_t)header.block_count * sizeof(block_t);
+    if (header.block_count != header.count / AVI_CHUNK_INDEX_BLOCK_SIZE + (header.count % AVI_CHUNK_INDEX_BLOCK_SIZE != 0) ||
+        position < 0 || fstat(fd, &st) != 0 || st.st_size < position ||
+        blocks_size + header.data_size > (uint64_t)(st.st_size - position)) {
+        return NULL;
+    }
+    avi_chunk_index_t *index = avi_chunk_index_create();
+    if (!index) return NULL;
+    if (header.block_count > 0) {
+        index->blocks = malloc(blocks_size);
+        index->data = malloc(header.data_size);
+        if (!index->blocks || !index->data ||
+            read(fd, index->blocks, blocks_size) != (ssize_t)blocks_size ||
+            read(fd, index->data, header.data_size) != (ssize_t)header.data_size) {
+            avi_chunk_index_delete(index);
+            return NULL;
+        }
+    }
+    index->count = header.count;
+    index->block_capacity = header.block_count;
+    index->data_size = header.data_size;
+    index->data_capacity = header.data_size;
+    if (!entries_in_bounds(index, header.block_count)) {
+        avi_chunk_index_delete(index);
+        return NULL;
+    }
+
+    // Restore the base of further appends
+    avi_chunk_t last;
+    if (avi_chunk_index_get(index, index->count - 1, &last)) {
+        index->last_offset = last.offset;
+        index->last_size = last.size;
+        index->total_size = last.position + last.size;
+    }
+    return index;
+}
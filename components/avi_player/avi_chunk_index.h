@@ -0,0 +1,45 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+// Compressed index of the chunks of one stream.
+// Entries are grouped in blocks of AVI_CHUNK_INDEX_BLOCK_SIZE. Each block keeps the file offset and
+// the stream position of its first chunk and the position of its encoded entries, so any entry is
+// found by decoding at most one block. Inside a block every entry is a varint pair: the gap from the
+// end of the previous chunk and the size change from the previous chunk (with the keyframe flag),
+// typically 3-5 bytes instead of the 16 bytes of an idx1 entry.
+
+#ifndef AVI_CHUNK_INDEX_BLOCK_SIZE
+#define AVI_CHUNK_INDEX_BLOCK_SIZE (64)
+#endif
+
+typedef struct {
+    uint64_t offset;       // File offset of the chunk header
+    uint32_t size;      // Payload size, without the header and padding
+    bool keyframe;
+    uint64_t position;  // Stream position: total payload size of the preceding chunks
+} avi_chunk_t;
+
+typedef struct avi_chunk_index avi_chunk_index_t;
+avi_chunk_index_t *avi_chunk_index_create(void);
+void avi_chunk_index_delete(avi_chunk_index_t *index);
+// Chunks must be appended in file order
+bool avi_chunk_index_append(avi_chunk_index_t *index, uint64_t offset, uint32_t size, bool keyframe);
+uint32_t avi_chunk_index_count(const avi_chunk_index_t *index);
+bool avi_chunk_index_get(const avi_chunk_index_t *index, uint32_t number, avi_chunk_t *chunk);
+// Number of the first chunk at or after the file offset (the chunk count if there is none)
+uint32_t avi_chunk_index_find_offset(const avi_chunk_index_t *index, uint64_t offset);
+// Number of the last keyframe at or before the chunk `number` (0 if there is none)
+uint32_t avi_chunk_index_find_keyframe(const avi_chunk_index_t *index, uint32_t number);
+// Number of the chunk that holds the stream position, false if the position is past the last chunk
+bool avi_chunk_index_find_position(const avi_chunk_index_t *index, uint64_t position, uint32_t *number, avi_chunk_t *chunk);
+// Release the spare capacity once no more chunks are appended
+void avi_chunk_index_trim(avi_chunk_index_t *index);
+// Heap memory used by the index
+size_t avi_chunk_index_memory_size(const avi_chunk_index_t *index);
+
+// Serialization for the sidecar cache
+bool avi_chunk_index_write(const avi_chunk_index_t *index, int fd);
+avi_chunk_index_t *avi_chunk_index_read(int fd);
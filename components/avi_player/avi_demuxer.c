@@ -1,6 +1,11 @@
 #include "avi_demuxer.h"
 #include "avi_structure.h"
 #include "buffered_reader.h"
+#include "avi_chunk_index.h"
+#include "avi_index_cache.h"
+#include "os_port.h"
+#include <string.h>
+#include <stdatomic.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -19,89 +24,513 @@ static const char *TAG = "avi_dmux";
 static void *memory_allocate(size_t size) { return malloc(size); }
 static void memory_free(void *ptr) { return free(ptr); }
 
+typedef enum {
+    INDEX_EVENT_PROGRESS = 1 << 0,  // A batch of idx1 entries was appended
+    INDEX_EVENT_DONE     = 1 << 1,  // No index task is running
+} index_event_t;
+
 typedef struct avi_dmux {
     buffered_reader_t *reader;
+    int fd;                     // Owned by the reader, also used with pread by the index task
+    char *path;
     avi_dmux_info_t *info;
+    // Built by index_task while playing, guarded by index_mutex
+    avi_chunk_index_t *index[AVI_DMUX_MAX_STREAMS];  // By stream number
+    os_mutex_t *index_mutex;
+    os_event_group_t *index_event;
+    atomic_bool index_cancel;
+    atomic_bool index_running;  // Cleared by index_task as its last access to dmux
+    uint64_t riff_end;             // End of the first RIFF, OpenDML 'AVIX' segments follow
+    uint64_t file_size;
+    // OpenDML super index ('indx') of each stream
+    avi_super_index_entry_t *super_index[AVI_DMUX_MAX_STREAMS];
+    uint32_t super_index_count[AVI_DMUX_MAX_STREAMS];
+    bool index_driven;          // Frames are located by the index instead of the chunk headers
+    uint32_t hint_video_end;    // Video frames before this one are announced to the reader (index mode)
+    int32_t frame_step;         // Video frames between the seeks of trick play, 1 in normal playback
+    bool scrub;                 // Seeking to preview frames, see avi_dmux_set_scrub
     uint32_t video_frame_count;
+    uint32_t audio_chunk_count;
+    // Set by a seek: chunks before the keyframe and the audio target are skipped, video frames from the
+    // keyframe to the target are decode-only, the target audio chunk starts `audio_drop_samples` in
+    uint32_t video_keyframe;
+    uint32_t video_target;
+    uint32_t audio_target;
+    uint32_t audio_drop_samples;
+    uint32_t frame_drop;        // Every frame_drop-th video frame past the seek target is delivered
+    uint32_t dropped_frames;    // Dropped since the last delivered video frame
+    // Data rate measurement over about one second of video
+    uint32_t data_rate;
+    uint32_t rate_start_frame;
+    uint64_t rate_start_offset;
 } avi_dmux_t;
 
-static bool build_video_index(avi_dmux_t *dmux, avi_dmux_info_t *info) {
-    if (info->idx1_location == 0 || info->idx1_size == 0) {
-        LOG_INFO("No idx1 chunk, indexing disabled");
-        return false;
-    }
+static void reset_data_rate_window(avi_dmux_t *dmux) {
+    dmux->rate_start_frame = dmux->video_frame_count;
+    dmux->rate_start_offset = br_lseek(dmux->reader, 0, SEEK_CUR);
+}
 
-    uint32_t total_video_frames = info->video.total_frames;
-    if (total_video_frames == 0) {
-        LOG_ERROR("Total frames is 0");
-        return false;
+// Feed the measured bytes/sec of movi data to the reader, which converts its read-ahead duration to bytes
+static void update_data_rate(avi_dmux_t *dmux) {
+    uint32_t frame_rate = dmux->info->video.frame_rate;
+    uint32_t frames = dmux->video_frame_count - dmux->rate_start_frame;
+    if (frame_rate == 0 || (uint64_t)frames * frame_rate < 1000000) return;
+    uint64_t offset = br_lseek(dmux->reader, 0, SEEK_CUR);
+    if (offset > dmux->rate_start_offset) {
+        uint32_t measured = (uint64_t)(offset - dmux->rate_start_offset) * 1000000 / ((uint64_t)frames * frame_rate);
+        dmux->data_rate = dmux->data_rate ? (dmux->data_rate + measured) / 2 : measured;
+        br_set_data_rate(dmux->reader, dmux->data_rate);
+        LOG_DEBUG("Data rate: %u KB/s (measured %u KB/s)", (unsigned int)(dmux->data_rate / 1024), (unsigned int)(measured / 1024));
     }
+    reset_data_rate_window(dmux);
+}
+
+// Offsets in idx1 are relative to the 'movi' FourCC, but some muxers write absolute file offsets
+static uint64_t idx1_offset_base(const avi_dmux_info_t *info, const avi_index_entry_t *first_entry) {
+    return first_entry->offset >= info->movi_location ? 0 : info->movi_location - 4;
+}
 
-    // Calculate skip interval to fit within max entries
-    uint32_t skip_interval = 1;
-    uint32_t entry_count = total_video_frames;
-    while (entry_count > AVI_DMUX_MAX_INDEX_ENTRIES) {
-        skip_interval++;
-        entry_count = (total_video_frames + skip_interval - 1) / skip_interval;
+static void delete_index(avi_dmux_t *dmux) {
+    for (int i = 0; i < AVI_DMUX_MAX_STREAMS; i++) {
+        avi_chunk_index_delete(dmux->index[i]);
+        dmux->index[i] = NULL;
     }
+}
 
-    info->index.skip_interval = skip_interval;
-    info->index.entry_count = entry_count;
+// Index of a stream, NULL for AVI_DMUX_STREAM_NONE or while no index is available
+static avi_chunk_index_t *stream_index(avi_dmux_t *dmux, uint8_t stream) {
+    return stream < AVI_DMUX_MAX_STREAMS ? dmux->index[stream] : NULL;
+}
 
-    // Allocate index array
-    info->index.frame_offsets = memory_allocate(sizeof(uint32_t) * entry_count);
-    if (!info->index.frame_offsets) {
-        LOG_ERROR("Failed to allocate index memory (%u entries)", (unsigned int)entry_count);
-        return false;
+// Stream number of a video or audio data chunk ('##dc', '##db' or '##wb'), -1 for other chunks
+static int data_chunk_stream(fourcc_t fourcc) {
+    int stream = chunk_stream_number(fourcc);
+    if (stream < 0 || stream >= AVI_DMUX_MAX_STREAMS) return -1;
+    chunk_type_t type = chunk_type(fourcc);
+    return type == CHUNK_TYPE_dc || type == CHUNK_TYPE_db || type == CHUNK_TYPE_wb ? stream : -1;
+}
+
+static void update_index_info(avi_dmux_t *dmux, avi_dmux_info_t *info) {
+    avi_chunk_index_t *video = stream_index(dmux, info->video.stream);
+    avi_chunk_index_t *audio = stream_index(dmux, info->audio.stream);
+    info->index.video_count = video ? avi_chunk_index_count(video) : 0;
+    info->index.audio_count = audio ? avi_chunk_index_count(audio) : 0;
+    info->index.memory_size = 0;
+    for (int i = 0; i < AVI_DMUX_MAX_STREAMS; i++) {
+        if (dmux->index[i]) info->index.memory_size += avi_chunk_index_memory_size(dmux->index[i]);
     }
+}
 
-    LOG_INFO("Building video index: %u total frames -> %u entries (skip=%u)",
-             (unsigned int)total_video_frames, (unsigned int)entry_count, (unsigned int)skip_interval);
+static void select_audio_stream(avi_dmux_info_t *info, uint8_t number) {
+    info->audio_stream_selected = number;
+    if (number < info->audio_stream_count) {
+        info->audio = info->audio_streams[number];
+    } else {
+        memset(&info->audio, 0, sizeof(info->audio));
+        info->audio.stream = AVI_DMUX_STREAM_NONE;
+    }
+}
 
-    // Read idx1 and extract video frame offsets
-    br_lseek(dmux->reader, info->idx1_location, SEEK_SET);
+static bool append_index(avi_dmux_t *dmux, int stream, uint64_t offset, uint32_t size, bool keyframe) {
+    os_mutex_lock(dmux->index_mutex);
+    bool result = avi_chunk_index_append(dmux->index[stream], offset, size, keyframe);
+    os_mutex_unlock(dmux->index_mutex);
+    if (!result) LOG_ERROR("Failed to allocate index memory at %lld", (long long)offset);
+    return result;
+}
 
-    uint32_t video_frame_index = 0;
-    uint32_t index_entry_pos = 0;
+// Read idx1 in large batches and append every video and audio chunk to the index of its stream.
+// `scan_offset` receives the end of the last indexed chunk, `complete` whether idx1 was read to its end.
+static bool read_idx1(avi_dmux_t *dmux, const avi_dmux_info_t *info, int fd, avi_index_entry_t *entries,
+                      uint64_t *scan_offset, bool *complete) {
     uint32_t entries_in_idx1 = info->idx1_size / sizeof(avi_index_entry_t);
+    const uint32_t batch_entries = AVI_DMUX_INDEX_BATCH_SIZE / sizeof(avi_index_entry_t);
+    uint64_t offset_base = 0;
+    *complete = false;
+
+    for (uint32_t i = 0; i < entries_in_idx1; ) {
+        if (atomic_load(&dmux->index_cancel)) return false;
+        uint32_t count = entries_in_idx1 - i;
+        if (count > batch_entries) count = batch_entries;
+        size_t bytes = count * sizeof(avi_index_entry_t);
+        ssize_t result = pread(fd, entries, bytes, info->idx1_location + (uint64_t)i * sizeof(avi_index_entry_t));
+        if (result < 0) {
+            LOG_ERROR("Failed to read idx1 entries %u-%u", (unsigned int)i, (unsigned int)(i + count - 1));
+            return false;
+        }
+        if ((size_t)result < bytes) {
+            // Truncated file, keep what is there and scan movi for the rest
+            LOG_INFO("idx1 truncated after %u of %u entries", (unsigned int)(i + result / sizeof(avi_index_entry_t)), (unsigned int)entries_in_idx1);
+            count = result / sizeof(avi_index_entry_t);
+            entries_in_idx1 = 0;
+        }
+        if (i == 0 && count > 0) offset_base = idx1_offset_base(info, &entries[0]);
+
+        os_mutex_lock(dmux->index_mutex);
+        bool appended = true;
+        for (uint32_t j = 0; j < count && appended; j++) {
+            int stream = data_chunk_stream(entries[j].chunk_id);
+            if (stream < 0) continue;
+            uint64_t offset = offset_base + entries[j].offset;
+            appended = avi_chunk_index_append(dmux->index[stream], offset, entries[j].size, entries[j].flags & AVIIF_KEYFRAME);
+            uint64_t end = offset + 8 + entries[j].size + (entries[j].size & 1);
+            if (end > *scan_offset) *scan_offset = end;
+        }
+        os_mutex_unlock(dmux->index_mutex);
+        if (!appended) {
+            LOG_ERROR("Failed to allocate index memory at idx1 entry %u", (unsigned int)i);
+            return false;
+        }
+        os_event_group_set_bits(dmux->index_event, INDEX_EVENT_PROGRESS);
+        i += count;
+        if (i == entries_in_idx1) *complete = true;
+    }
+    return true;
+}
+
+// Chunk IDs in movi are printable FourCCs ('00dc', 'ix00', 'JUNK', ...). Anything else is
+// where the recording stopped (zero-filled or unwritten clusters).
+static bool is_chunk_id(fourcc_t fourcc) {
+    for (int i = 0; i < 4; i++) {
+        uint8_t c = fourcc >> (i * 8);
+        if (c < 0x20 || c > 0x7E) return false;
+    }
+    return true;
+}
+
+// Rebuild the index from the chunk headers in movi, for files without idx1 or with a truncated one.
+// Headers are read through a window of AVI_DMUX_INDEX_BATCH_SIZE, payloads larger than that are
+// skipped without reading them. Continues into the movi lists of OpenDML 'AVIX' segments.
+static bool scan_movi(avi_dmux_t *dmux, int fd, uint8_t *buffer, uint64_t offset, uint64_t end) {
+    const size_t header_size = sizeof(chunk_header_t) + sizeof(fourcc_t);  // With the type of RIFF/LIST
+    uint64_t window_offset = 0;
+    size_t window_size = 0;
+    uint32_t chunk_count = 0;
+    LOG_INFO("Scanning movi from %lld to %lld", (long long)offset, (long long)end);
+    while (offset + sizeof(chunk_header_t) <= end) {
+        if (offset < window_offset || offset + header_size > window_offset + window_size) {
+            if (atomic_load(&dmux->index_cancel)) return false;
+            os_event_group_set_bits(dmux->index_event, INDEX_EVENT_PROGRESS);
+            ssize_t result = pread(fd, buffer, AVI_DMUX_INDEX_BATCH_SIZE, offset);
+            if (result < (ssize_t)sizeof(chunk_header_t)) break;
+            window_offset = offset;
+            window_size = result;
+        }
+        chunk_header_t chunk;
+        fourcc_t type = 0;
+        memcpy(&chunk, buffer + (offset - window_offset), sizeof(chunk));
+        if (offset + header_size <= window_offset + window_size) {
+            memcpy(&type, buffer + (offset - window_offset) + sizeof(chunk), sizeof(type));
+        }
+        if (!is_chunk_id(chunk.fourcc)) {
+            LOG_INFO("movi scan stopped at invalid chunk ID 0x%08x at %lld", (unsigned int)chunk.fourcc, (long long)offset);
+            break;
+        }
+        if ((chunk.fourcc == FOURCC_RIFF && type == FOURCC_AVIX) ||
+            (chunk.fourcc == FOURCC_LIST && (type == FOURCC_movi || type == FOURCC_rec))) {
+            // Step into the next segment, its movi list, or a 'rec ' group
+            offset += header_size;
+            continue;
+        }
+        uint64_t next = offset + sizeof(chunk_header_t) + chunk.size + (chunk.size & 1);
+        if (next - (chunk.size & 1) > end) {
+            LOG_INFO("movi scan stopped at incomplete chunk at %lld", (long long)offset);
+            break;
+        }
+        // The keyframe flag is only known from an index, MJPEG and PCM/MP3 chunks are all keyframes
+        int stream = data_chunk_stream(chunk.fourcc);
+        if (stream >= 0) {
+            if (!append_index(dmux, stream, offset, chunk.size, true)) return false;
+            chunk_count++;
+        }
+        offset = next;
+    }
+    LOG_INFO("movi scan found %u chunks", (unsigned int)chunk_count);
+    return true;
+}
 
-    for (uint32_t i = 0; i < entries_in_idx1; i++) {
-        avi_index_entry_t entry;
-        if (br_read(dmux->reader, &entry, sizeof(entry)) != sizeof(entry)) {
-            LOG_ERROR("Failed to read idx1 entry %u", (unsigned int)i);
-            memory_free(info->index.frame_offsets);
-            info->index.frame_offsets = NULL;
+// Append the chunks of one OpenDML standard index ('ix##' chunk) to the index of `stream`
+static bool read_std_index(avi_dmux_t *dmux, int fd, avi_std_index_entry_t *entries, int stream, uint64_t position) {
+    struct {
+        chunk_header_t chunk;
+        avi_std_index_header_t index;
+    } __attribute__((packed)) header;
+    if (pread(fd, &header, sizeof(header), position) != sizeof(header)) {
+        LOG_INFO("Standard index at %lld is missing", (long long)position);
+        return true;
+    }
+    if (header.index.index_type != AVI_INDEX_OF_CHUNKS || header.index.longs_per_entry != 2 ||
+        header.chunk.size < sizeof(header.index) ||
+        header.index.entries_in_use > (header.chunk.size - sizeof(header.index)) / sizeof(avi_std_index_entry_t)) {
+        LOG_ERROR("Invalid standard index at %lld", (long long)position);
+        return true;
+    }
+    const uint32_t batch_entries = AVI_DMUX_INDEX_BATCH_SIZE / sizeof(avi_std_index_entry_t);
+    position += sizeof(header);
+    for (uint32_t i = 0; i < header.index.entries_in_use; ) {
+        if (atomic_load(&dmux->index_cancel)) return false;
+        uint32_t count = header.index.entries_in_use - i;
+        if (count > batch_entries) count = batch_entries;
+        ssize_t result = pread(fd, entries, count * sizeof(avi_std_index_entry_t), position + (uint64_t)i * sizeof(avi_std_index_entry_t));
+        if (result < 0) return false;
+        count = result / sizeof(avi_std_index_entry_t);
+        if (count == 0) break;  // Truncated file
+
+        os_mutex_lock(dmux->index_mutex);
+        bool appended = true;
+        for (uint32_t j = 0; j < count && appended; j++) {
+            // Entries point to the chunk data, the index keeps the chunk header
+            uint64_t offset = header.index.base_offset + entries[j].offset - sizeof(chunk_header_t);
+            appended = avi_chunk_index_append(dmux->index[stream], offset, entries[j].size & ~AVI_INDEX_DELTA_FRAME,
+                                              !(entries[j].size & AVI_INDEX_DELTA_FRAME));
+        }
+        os_mutex_unlock(dmux->index_mutex);
+        if (!appended) {
+            LOG_ERROR("Failed to allocate index memory");
             return false;
         }
+        os_event_group_set_bits(dmux->index_event, INDEX_EVENT_PROGRESS);
+        i += count;
+    }
+    return true;
+}
 
-        // Check if this is a video frame
-        if (entry.chunk_id == FOURCC_00db || entry.chunk_id == FOURCC_00dc) {
-            // Should we store this frame?
-            if (video_frame_index % skip_interval == 0) {
-                if (index_entry_pos < entry_count) {
-                    info->index.frame_offsets[index_entry_pos] = entry.offset;
-                    index_entry_pos++;
-                }
+// End of the last chunk in the index so far
+static uint64_t indexed_end(avi_dmux_t *dmux) {
+    uint64_t end = 0;
+    for (int i = 0; i < AVI_DMUX_MAX_STREAMS; i++) {
+        avi_chunk_t chunk;
+        uint32_t count = avi_chunk_index_count(dmux->index[i]);
+        if (count > 0 && avi_chunk_index_get(dmux->index[i], count - 1, &chunk)) {
+            uint64_t chunk_end = chunk.offset + sizeof(chunk_header_t) + chunk.size + (chunk.size & 1);
+            if (chunk_end > end) end = chunk_end;
+        }
+    }
+    return end;
+}
+
+static bool build_index(avi_dmux_t *dmux, const avi_dmux_info_t *info) {
+    // pread on the reader's descriptor leaves its file position alone. Opening the file again would
+    // cost another cluster map under FATFS fast seek.
+    int fd = dmux->fd;
+    void *buffer = memory_allocate(AVI_DMUX_INDEX_BATCH_SIZE);
+    if (!buffer) {
+        LOG_ERROR("Failed to prepare index build");
+        return false;
+    }
+
+    bool result = true;
+    uint32_t segments = 0;
+    for (int stream = 0; stream < AVI_DMUX_MAX_STREAMS; stream++) {
+        if (dmux->super_index_count[stream] > segments) segments = dmux->super_index_count[stream];
+    }
+    if (info->video.stream < AVI_DMUX_MAX_STREAMS && dmux->super_index[info->video.stream]) {
+        // OpenDML: the standard indexes cover every RIFF segment, idx1 only the first one
+        LOG_INFO("Reading OpenDML indexes");
+        // Segment by segment, so a seek into a segment finds its audio along with its video
+        for (uint32_t i = 0; i < segments && result; i++) {
+            for (int stream = 0; stream < AVI_DMUX_MAX_STREAMS && result; stream++) {
+                if (i < dmux->super_index_count[stream]) result = read_std_index(dmux, fd, buffer, stream, dmux->super_index[stream][i].offset);
             }
-            video_frame_index++;
         }
+        // The last segment of an unfinished recording has no standard index yet
+        uint64_t scan_offset = indexed_end(dmux);
+        if (scan_offset == 0) scan_offset = info->movi_location;
+        if (result && scan_offset < dmux->file_size) result = scan_movi(dmux, fd, buffer, scan_offset, dmux->file_size);
+    } else {
+        uint64_t scan_offset = info->movi_location;
+        bool complete = false;
+        if (info->idx1_location > 0 && info->idx1_size > 0) {
+            result = read_idx1(dmux, info, fd, buffer, &scan_offset, &complete);
+        } else {
+            LOG_INFO("No idx1 chunk");
+        }
+        // Scan what idx1 does not cover: the rest of a truncated movi, or 'AVIX' segments without indx
+        if (complete) scan_offset = dmux->riff_end;
+        if (result && scan_offset < dmux->file_size) result = scan_movi(dmux, fd, buffer, scan_offset, dmux->file_size);
     }
+    memory_free(buffer);
+    return result;
+}
 
-    LOG_INFO("Index built: %u/%u entries filled", (unsigned int)index_entry_pos, (unsigned int)entry_count);
-    return true;
+static void index_task(void *arg) {
+    avi_dmux_t *dmux = arg;
+    int64_t start_time = os_time_us();
+    bool result = build_index(dmux, dmux->info);
+
+    os_mutex_lock(dmux->index_mutex);
+    if (result) {
+        for (int i = 0; i < AVI_DMUX_MAX_STREAMS; i++) avi_chunk_index_trim(dmux->index[i]);
+    } else {
+        delete_index(dmux);
+    }
+    update_index_info(dmux, dmux->info);
+    // avih of an unfinished recording has no frame count
+    if (dmux->info->video.total_frames == 0) dmux->info->video.total_frames = dmux->info->index.video_count;
+    os_mutex_unlock(dmux->index_mutex);
+
+    if (result) {
+        LOG_INFO("Index built: %u video / %u audio chunks in %u bytes, %.1f ms",
+                 (unsigned int)dmux->info->index.video_count, (unsigned int)dmux->info->index.audio_count,
+                 (unsigned int)dmux->info->index.memory_size, (os_time_us() - start_time) / 1000.0);
+        // Keep it for the next open
+        avi_index_cache_save(dmux->path, dmux->info, dmux->index, AVI_DMUX_MAX_STREAMS);
+    }
+    os_event_group_set_bits(dmux->index_event, INDEX_EVENT_PROGRESS | INDEX_EVENT_DONE);
+    atomic_store(&dmux->index_running, false);
+}
+
+// Build the index from idx1, the OpenDML indexes or the movi chunk headers on a background task,
+// playback can start from movi right away
+static void start_index_build(avi_dmux_t *dmux) {
+    if (dmux->info->movi_location == 0) {
+        LOG_INFO("No movi data, indexing disabled");
+        return;
+    }
+    for (int i = 0; i < AVI_DMUX_MAX_STREAMS; i++) {
+        dmux->index[i] = avi_chunk_index_create();
+        if (!dmux->index[i]) {
+            LOG_ERROR("Failed to allocate index");
+            delete_index(dmux);
+            return;
+        }
+    }
+    os_event_group_clear_bits(dmux->index_event, INDEX_EVENT_DONE);
+    atomic_store(&dmux->index_running, true);
+    if (!os_task_create(index_task, "avi_index", 4096, dmux, AVI_DMUX_INDEX_TASK_PRIORITY, AVI_DMUX_INDEX_TASK_CORE, NULL)) {
+        LOG_ERROR("Failed to create index task");
+        atomic_store(&dmux->index_running, false);
+        delete_index(dmux);
+        os_event_group_set_bits(dmux->index_event, INDEX_EVENT_DONE);
+    }
+}
+
+// Wait until the video chunk `frame_number` is indexed, the build ends or the timeout expires
+static void wait_index(avi_dmux_t *dmux, uint32_t frame_number) {
+    int64_t deadline = os_time_us() + AVI_DMUX_INDEX_WAIT_MS * 1000;
+    while (true) {
+        uint32_t event = os_event_group_clear_bits(dmux->index_event, INDEX_EVENT_PROGRESS);
+        if (event & INDEX_EVENT_DONE) return;
+        os_mutex_lock(dmux->index_mutex);
+        avi_chunk_index_t *index = stream_index(dmux, dmux->info->video.stream);
+        bool indexed = !index || frame_number < avi_chunk_index_count(index);
+        os_mutex_unlock(dmux->index_mutex);
+        if (indexed) return;
+        int64_t remaining = deadline - os_time_us();
+        if (remaining <= 0) return;
+        os_event_group_wait_bits(dmux->index_event, INDEX_EVENT_PROGRESS | INDEX_EVENT_DONE, false, (remaining + 999) / 1000);
+    }
+}
+
+// Data rate from avih, falling back to the average over the whole file when the muxer left it 0
+static uint32_t probe_bytes_per_sec(int fd) {
+    struct {
+        chunk_header_t riff;
+        fourcc_t avi;
+        chunk_header_t hdrl;
+        fourcc_t hdrl_type;
+        chunk_header_t avih_chunk;
+        avi_main_header_t avih;
+    } __attribute__((packed)) header;
+    ssize_t result = pread(fd, &header, sizeof(header), 0);
+    uint64_t file_size = lseek(fd, 0, SEEK_END);
+    lseek(fd, 0, SEEK_SET);
+    if (result != sizeof(header) || header.riff.fourcc != FOURCC_RIFF || header.avi != FOURCC_AVI ||
+        header.hdrl.fourcc != FOURCC_LIST || header.hdrl_type != FOURCC_hdrl || header.avih_chunk.fourcc != FOURCC_avih) {
+        return 0;
+    }
+    if (header.avih.max_bytes_per_sec > 0) return header.avih.max_bytes_per_sec;
+    uint64_t duration_us = (uint64_t)header.avih.total_frames * header.avih.micro_sec_per_frame;
+    if (duration_us == 0) return 0;
+    return file_size * 1000000ULL / duration_us;
+}
+
+// Read ahead AVI_DMUX_READ_AHEAD_SEC of data, in a ring with 50% headroom for bitrate peaks
+static uint32_t reader_config_for_file(int fd, br_config_t *config) {
+    config->read_ahead_ms = AVI_DMUX_READ_AHEAD_SEC * 1000;
+    config->low_watermark_ms = AVI_DMUX_LOW_WATERMARK_MS;
+    config->boost_priority = AVI_DMUX_PRELOAD_BOOST_PRIORITY;
+    config->direct_io = AVI_DMUX_DIRECT_IO;
+    uint32_t bytes_per_sec = probe_bytes_per_sec(fd);
+    if (bytes_per_sec == 0) return 0;
+    uint64_t chunk_num = ((uint64_t)bytes_per_sec * AVI_DMUX_READ_AHEAD_SEC * 3 / 2 + config->chunk_size - 1) / config->chunk_size + 1;
+    if (chunk_num < AVI_DMUX_MIN_CHUNK_NUM) chunk_num = AVI_DMUX_MIN_CHUNK_NUM;
+    if (chunk_num > AVI_DMUX_MAX_CHUNK_NUM) chunk_num = AVI_DMUX_MAX_CHUNK_NUM;
+    config->chunk_num = chunk_num;
+    LOG_INFO("Data rate %u KB/s -> %u chunks read-ahead", (unsigned int)(bytes_per_sec / 1024), (unsigned int)chunk_num);
+    return bytes_per_sec;
+}
+
+uint32_t avi_dmux_reader_config(const char *file, br_config_t *config) {
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open file: %s", file);
+        return 0;
+    }
+    uint32_t bytes_per_sec = reader_config_for_file(fd, config);
+    close(fd);
+    return bytes_per_sec;
 }
 
 avi_dmux_t *avi_dmux_create(const char *file) {
+    return avi_dmux_create_ex(file, NULL);
+}
+
+avi_dmux_t *avi_dmux_create_ex(const char *file, const br_config_t *config) {
+    // One open for the header probe, the reader and the index build
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open file: %s", file);
+        return NULL;
+    }
+    br_config_t file_config = BR_CONFIG_DEFAULT();
+    uint32_t data_rate;
+    if (!config) {
+        data_rate = reader_config_for_file(fd, &file_config);
+        config = &file_config;
+    } else {
+        // A given config still gets its read-ahead duration converted from the start
+        data_rate = probe_bytes_per_sec(fd);
+    }
     buffered_reader_t *reader;
-    reader = br_open(file);
+    reader = br_open_fd(file, fd, config);
     if (!reader) {
         LOG_ERROR("Failed to open file: %s", file);
         return NULL;
     }
     avi_dmux_t *dmux = memory_allocate(sizeof(avi_dmux_t));
     dmux->reader = reader;
+    dmux->fd = fd;
+    dmux->path = strdup(file);
     dmux->info = NULL;
+    for (int i = 0; i < AVI_DMUX_MAX_STREAMS; i++) dmux->index[i] = NULL;
+    dmux->index_mutex = os_mutex_create();
+    dmux->index_event = os_event_group_create();
+    os_event_group_set_bits(dmux->index_event, INDEX_EVENT_DONE);
+    atomic_init(&dmux->index_cancel, false);
+    atomic_init(&dmux->index_running, false);
+    dmux->riff_end = 0;
+    dmux->file_size = 0;
+    for (int i = 0; i < AVI_DMUX_MAX_STREAMS; i++) {
+        dmux->super_index[i] = NULL;
+        dmux->super_index_count[i] = 0;
+    }
+    dmux->index_driven = false;
+    dmux->hint_video_end = 0;
+    dmux->frame_step = 1;
+    dmux->scrub = false;
     dmux->video_frame_count = 0;
+    dmux->audio_chunk_count = 0;
+    dmux->video_keyframe = 0;
+    dmux->video_target = 0;
+    dmux->audio_target = 0;
+    dmux->audio_drop_samples = 0;
+    dmux->frame_drop = 1;
+    dmux->dropped_frames = 0;
+    dmux->data_rate = data_rate;
+    dmux->rate_start_frame = 0;
+    dmux->rate_start_offset = 0;
+    if (data_rate) br_set_data_rate(reader, data_rate);
     return dmux;
 }
 
@@ -109,217 +538,284 @@ void avi_dmux_delete(avi_dmux_t *dmux) {
     if (!dmux) {
         return;
     }
+    // Stop the index task first, it uses the path and info
+    atomic_store(&dmux->index_cancel, true);
+    while (atomic_load(&dmux->index_running)) os_delay_ms(10);
+    os_event_group_delete(dmux->index_event);
+    os_mutex_delete(dmux->index_mutex);
     br_close(dmux->reader);
+    free(dmux->path);
+    delete_index(dmux);
+    for (int i = 0; i < AVI_DMUX_MAX_STREAMS; i++) memory_free(dmux->super_index[i]);
     if (dmux->info) {
-        if (dmux->info->index.frame_offsets) {
-            memory_free(dmux->info->index.frame_offsets);
-        }
         memory_free(dmux->info);
     }
     memory_free(dmux);
 }
 
-avi_dmux_info_t *avi_dmux_parse_info(avi_dmux_t *dmux) {
-    avi_dmux_info_t *info = memory_allocate(sizeof(avi_dmux_info_t));
-    if (!info) {
-        LOG_ERROR("Failed to allocate memory for info");
-        return NULL;
+// Bounds-checked reader over a chunk held in memory
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t position;
+} riff_cursor_t;
+
+static bool cursor_read(riff_cursor_t *cursor, void *value, size_t size) {
+    if (cursor->size - cursor->position < size) return false;
+    memcpy(value, cursor->data + cursor->position, size);
+    cursor->position += size;
+    return true;
+}
+
+// Read a structure that may be shorter (older versions) or longer (extensions) in the file.
+// Missing fields are zero.
+static void cursor_read_struct(riff_cursor_t *cursor, void *value, size_t size) {
+    size_t available = cursor->size - cursor->position;
+    size_t length = available < size ? available : size;
+    memset(value, 0, size);
+    memcpy(value, cursor->data + cursor->position, length);
+    cursor->position += length;
+}
+
+// Next sub-chunk. `body` covers its data, clamped to the parent. The cursor moves past the padding.
+static bool cursor_next_chunk(riff_cursor_t *cursor, chunk_header_t *chunk, riff_cursor_t *body) {
+    if (!cursor_read(cursor, chunk, sizeof(*chunk))) return false;
+    size_t available = cursor->size - cursor->position;
+    body->data = cursor->data + cursor->position;
+    body->size = chunk->size < available ? chunk->size : available;
+    body->position = 0;
+    size_t padded = (size_t)chunk->size + (chunk->size & 1);
+    cursor->position += padded < available ? padded : available;
+    return true;
+}
+
+// OpenDML 'indx' in strl. Only super indexes are used, they point to the 'ix##' chunks in each RIFF segment.
+static void parse_super_index(avi_dmux_t *dmux, uint8_t stream, riff_cursor_t *body) {
+    if (stream >= AVI_DMUX_MAX_STREAMS) return;
+    avi_super_index_header_t header;
+    if (dmux->super_index[stream] || !cursor_read(body, &header, sizeof(header))) return;
+    uint32_t count = header.entries_in_use;
+    if (header.index_type != AVI_INDEX_OF_INDEXES || header.longs_per_entry != 4 ||
+        count == 0 || count > (body->size - body->position) / sizeof(avi_super_index_entry_t)) {
+        LOG_INFO("Unsupported indx (type %u, %u entries)", (unsigned int)header.index_type, (unsigned int)count);
+        return;
     }
+    avi_super_index_entry_t *entries = memory_allocate(count * sizeof(avi_super_index_entry_t));
+    if (!entries) return;
+    cursor_read(body, entries, count * sizeof(avi_super_index_entry_t));
+    dmux->super_index[stream] = entries;
+    dmux->super_index_count[stream] = count;
+    LOG_DEBUG("    OpenDML super index: %u entries", (unsigned int)count);
+}
 
-    // Initialize idx1 fields
-    info->idx1_location = 0;
-    info->idx1_size = 0;
-    info->index.frame_offsets = NULL;
-    info->index.entry_count = 0;
-    info->index.skip_interval = 1;
+// strl of the stream `stream`, the first video stream and every audio stream go to the stream table
+static void parse_strl(avi_dmux_t *dmux, avi_dmux_info_t *info, riff_cursor_t *strl, uint8_t stream) {
+    avi_stream_header_t strh;
+    memset(&strh, 0, sizeof(strh));
+    chunk_header_t chunk;
+    riff_cursor_t body;
+    while (cursor_next_chunk(strl, &chunk, &body)) {
+        LOG_DEBUG("    strl chunk: fourcc=0x%08x, size=%u", (unsigned int)chunk.fourcc, (unsigned int)chunk.size);
+        if (chunk.fourcc == FOURCC_strh) {
+            cursor_read_struct(&body, &strh, sizeof(strh));
+        } else if (chunk.fourcc == FOURCC_strf && strh.fourcc_type == FOURCC_vids && info->video.stream == AVI_DMUX_STREAM_NONE) {
+            bitmap_info_header_t bih;
+            cursor_read_struct(&body, &bih, sizeof(bih));
+            info->video.codec = fourcc_to_video_codec(bih.compression);
+            info->video.max_frame_size = strh.suggested_buffer_size;
+            info->video.scale = strh.scale;
+            info->video.rate = strh.rate;
+            info->video.stream = stream;
+            LOG_DEBUG("      Video %u: codec=0x%08x, max_size=%u", (unsigned int)stream, (unsigned int)bih.compression, (unsigned int)strh.suggested_buffer_size);
+        } else if (chunk.fourcc == FOURCC_strf && strh.fourcc_type == FOURCC_auds && info->audio_stream_count < AVI_DMUX_MAX_AUDIO_STREAMS) {
+            // WAVEFORMAT (14 bytes), PCMWAVEFORMAT (16) or WAVEFORMATEX (18 + extra)
+            wave_format_ex_t wfx;
+            cursor_read_struct(&body, &wfx, sizeof(wfx));
+            avi_dmux_audio_info_t *audio = &info->audio_streams[info->audio_stream_count++];
+            audio->codec = format_tag_to_audio_codec(wfx.format_tag);
+            audio->channels = wfx.channels;
+            audio->sampling_rate = wfx.samples_per_sec;
+            audio->bits_per_sample = wfx.bits_per_sample;
+            audio->max_frame_size = strh.suggested_buffer_size;
+            audio->scale = strh.scale;
+            audio->rate = strh.rate;
+            audio->sample_size = strh.sample_size;
+            audio->block_align = wfx.block_align;
+            audio->stream = stream;
+            LOG_DEBUG("      Audio %u: format=0x%04x, channels=%u, rate=%u, bits=%u, max_size=%u, scale=%u/%u, sample_size=%u",
+                      (unsigned int)stream, (unsigned int)wfx.format_tag, (unsigned int)wfx.channels, (unsigned int)wfx.samples_per_sec,
+                      (unsigned int)wfx.bits_per_sample, (unsigned int)strh.suggested_buffer_size,
+                      (unsigned int)strh.scale, (unsigned int)strh.rate, (unsigned int)strh.sample_size);
+        } else if (chunk.fourcc == FOURCC_indx && (strh.fourcc_type == FOURCC_vids || strh.fourcc_type == FOURCC_auds)) {
+            parse_super_index(dmux, stream, &body);
+        }
+    }
+}
+
+static void parse_hdrl(avi_dmux_t *dmux, avi_dmux_info_t *info, riff_cursor_t *hdrl) {
+    chunk_header_t chunk;
+    riff_cursor_t body;
+    while (cursor_next_chunk(hdrl, &chunk, &body)) {
+        LOG_DEBUG("  hdrl chunk: fourcc=0x%08x, size=%u", (unsigned int)chunk.fourcc, (unsigned int)chunk.size);
+        fourcc_t list_type;
+        if (chunk.fourcc == FOURCC_avih) {
+            avi_main_header_t avih;
+            cursor_read_struct(&body, &avih, sizeof(avih));
+            info->video.width = avih.width;
+            info->video.height = avih.height;
+            info->video.total_frames = avih.total_frames;
+            info->video.frame_rate = avih.micro_sec_per_frame;
+        } else if (chunk.fourcc == FOURCC_LIST && cursor_read(&body, &list_type, sizeof(list_type))) {
+            if (list_type == FOURCC_strl) {
+                // Streams are numbered in the order of their strl lists
+                parse_strl(dmux, info, &body, info->stream_count++);
+            } else if (list_type == FOURCC_odml) {
+                // OpenDML extended header: avih only counts the frames of the first RIFF
+                chunk_header_t dmlh;
+                riff_cursor_t dmlh_body;
+                uint32_t total_frames;
+                if (cursor_next_chunk(&body, &dmlh, &dmlh_body) && dmlh.fourcc == FOURCC_dmlh &&
+                    cursor_read(&dmlh_body, &total_frames, sizeof(total_frames)) && total_frames > 0) {
+                    info->video.total_frames = total_frames;
+                }
+            }
+        }
+    }
+}
 
-    // Seek to start
+// Walk the top-level chunks of the first RIFF. The first AVI_DMUX_HEADER_READ_SIZE bytes are read at once,
+// which normally covers hdrl and the start of movi; a larger hdrl is read in one more request.
+static bool parse_riff(avi_dmux_t *dmux, avi_dmux_info_t *info) {
+    uint64_t file_size = br_lseek(dmux->reader, 0, SEEK_END);
+    dmux->file_size = file_size;
+    uint8_t *buffer = memory_allocate(AVI_DMUX_HEADER_READ_SIZE);
+    if (!buffer) {
+        LOG_ERROR("Failed to allocate header buffer");
+        return false;
+    }
     br_lseek(dmux->reader, 0, SEEK_SET);
+    size_t length = br_read(dmux->reader, buffer, AVI_DMUX_HEADER_READ_SIZE);
 
-    // Read RIFF header
+    // RIFF header and AVI signature
+    riff_cursor_t cursor = { .data = buffer, .size = length, .position = 0 };
     chunk_header_t riff_header;
-    if (br_read(dmux->reader, &riff_header, sizeof(riff_header)) != sizeof(riff_header)) {
+    fourcc_t avi_sig;
+    if (!cursor_read(&cursor, &riff_header, sizeof(riff_header)) || !cursor_read(&cursor, &avi_sig, sizeof(avi_sig))) {
         LOG_ERROR("Failed to read RIFF header");
-        memory_free(info);
-        return NULL;
+        memory_free(buffer);
+        return false;
     }
-
     if (riff_header.fourcc != FOURCC_RIFF) {
         LOG_ERROR("Invalid RIFF signature");
-        memory_free(info);
-        return NULL;
-    }
-
-    // Read AVI signature
-    fourcc_t avi_sig;
-    if (br_read(dmux->reader, &avi_sig, sizeof(avi_sig)) != sizeof(avi_sig)) {
-        LOG_ERROR("Failed to read AVI signature");
-        memory_free(info);
-        return NULL;
+        memory_free(buffer);
+        return false;
     }
-
     if (avi_sig != FOURCC_AVI) {
         LOG_ERROR("Invalid AVI signature");
-        memory_free(info);
-        return NULL;
+        memory_free(buffer);
+        return false;
     }
-
-    // Parse chunks
-    while (1) {
-        chunk_header_t chunk;
-        off_t chunk_pos = br_lseek(dmux->reader, 0, SEEK_CUR);
-        if (br_read(dmux->reader, &chunk, sizeof(chunk)) != sizeof(chunk)) {
-            break;
+    dmux->riff_end = 8 + (uint64_t)riff_header.size;
+    if (dmux->riff_end > file_size || riff_header.size == 0) dmux->riff_end = file_size;
+
+    // Parse chunks of the first RIFF
+    uint64_t chunk_pos = cursor.position;
+    while (chunk_pos + sizeof(chunk_header_t) <= dmux->riff_end) {
+        struct {
+            chunk_header_t chunk;
+            fourcc_t list_type;
+        } __attribute__((packed)) header;
+        if (chunk_pos + sizeof(header) <= length) {
+            memcpy(&header, buffer + chunk_pos, sizeof(header));
+        } else {
+            // Past the first block (idx1 after movi)
+            memset(&header, 0, sizeof(header));
+            br_lseek(dmux->reader, chunk_pos, SEEK_SET);
+            if (br_read(dmux->reader, &header, sizeof(header)) < sizeof(chunk_header_t)) break;
         }
-
+        chunk_header_t chunk = header.chunk;
+        uint64_t chunk_end = chunk_pos + sizeof(chunk_header_t) + chunk.size + (chunk.size & 1);
         LOG_DEBUG("Parsing chunk at %lld: fourcc=0x%08x, size=%u", (long long)chunk_pos, (unsigned int)chunk.fourcc, (unsigned int)chunk.size);
 
-        if (chunk.fourcc == FOURCC_LIST) {
-            fourcc_t list_type;
-            off_t list_end = chunk_pos + 8 + chunk.size;
-            br_read(dmux->reader, &list_type, sizeof(list_type));
-            LOG_DEBUG("  LIST type: 0x%08x, list_end=%lld", (unsigned int)list_type, (long long)list_end);
-
-            if (list_type == FOURCC_movi) {
-                // Found movie data (LIST movi), save location
-                info->movi_location = br_lseek(dmux->reader, 0, SEEK_CUR);
-                LOG_DEBUG("Found movi chunk at position %lld", (long long)info->movi_location);
-                // Skip to the end of movi to continue searching for idx1
-                br_lseek(dmux->reader, list_end, SEEK_SET);
-                continue;
+        if (chunk.fourcc == FOURCC_LIST && header.list_type == FOURCC_movi) {
+            // Found movie data (LIST movi), save location
+            info->movi_location = chunk_pos + sizeof(header);
+            LOG_DEBUG("Found movi chunk at position %lld", (long long)info->movi_location);
+            if (chunk.size <= 4 || chunk_end > file_size) {
+                // Unfinished recording: the size was never written, movi runs to the end of the file
+                LOG_INFO("movi list size %u is past the end of the file, truncated recording", (unsigned int)chunk.size);
+                dmux->riff_end = file_size;
+                break;
             }
-
-            // For hdrl and strl, we still need to parse the contents
-            if (list_type == FOURCC_hdrl || list_type == FOURCC_strl) {
-                // Parse sub-chunks within this LIST
-                while (br_lseek(dmux->reader, 0, SEEK_CUR) < list_end) {
-                    chunk_header_t sub_chunk;
-                    off_t sub_pos = br_lseek(dmux->reader, 0, SEEK_CUR);
-                    if (br_read(dmux->reader, &sub_chunk, sizeof(sub_chunk)) != sizeof(sub_chunk)) {
-                        break;
-                    }
-
-                    LOG_DEBUG("  Sub-chunk at %lld: fourcc=0x%08x, size=%u", (long long)sub_pos, (unsigned int)sub_chunk.fourcc, (unsigned int)sub_chunk.size);
-
-                    if (sub_chunk.fourcc == FOURCC_avih) {
-                        avi_main_header_t avih;
-                        br_read(dmux->reader, &avih, sizeof(avih));
-                        info->video.width = avih.width;
-                        info->video.height = avih.height;
-                        info->video.total_frames = avih.total_frames;
-                        info->video.frame_rate = avih.micro_sec_per_frame;
-                    } else if (sub_chunk.fourcc == FOURCC_LIST) {
-                        // Nested LIST (e.g., LIST strl)
-                        fourcc_t nested_list_type;
-                        off_t nested_list_end = sub_pos + 8 + sub_chunk.size;
-                        br_read(dmux->reader, &nested_list_type, sizeof(nested_list_type));
-                        LOG_DEBUG("    Nested LIST type: 0x%08x", (unsigned int)nested_list_type);
-
-                        if (nested_list_type == FOURCC_strl) {
-                            // Parse strl contents
-                            while (br_lseek(dmux->reader, 0, SEEK_CUR) < nested_list_end) {
-                                chunk_header_t strl_chunk;
-                                if (br_read(dmux->reader, &strl_chunk, sizeof(strl_chunk)) != sizeof(strl_chunk)) {
-                                    break;
-                                }
-
-                                LOG_DEBUG("      strl chunk: fourcc=0x%08x, size=%u", (unsigned int)strl_chunk.fourcc, (unsigned int)strl_chunk.size);
-
-                                if (strl_chunk.fourcc == FOURCC_strh) {
-                                    avi_stream_header_t strh;
-                                    br_read(dmux->reader, &strh, sizeof(strh));
-
-                                    // Read the strf chunk that follows
-                                    chunk_header_t strf_chunk;
-                                    br_read(dmux->reader, &strf_chunk, sizeof(strf_chunk));
-
-                                    if (strf_chunk.fourcc == FOURCC_strf) {
-                                        if (strh.fourcc_type == FOURCC_vids) {
-                                            bitmap_info_header_t bih;
-                                            br_read(dmux->reader, &bih, sizeof(bih));
-                                            info->video.codec = fourcc_to_video_codec(bih.compression);
-                                            info->video.max_frame_size = strh.suggested_buffer_size;
-                                            LOG_DEBUG("        Video: codec=0x%08x, max_size=%u", (unsigned int)bih.compression, (unsigned int)strh.suggested_buffer_size);
-                                            // Skip remaining bytes if any
-                                            if (strf_chunk.size > sizeof(bih)) {
-                                                br_lseek(dmux->reader, strf_chunk.size - sizeof(bih), SEEK_CUR);
-                                            }
-                                        } else if (strh.fourcc_type == FOURCC_auds) {
-                                            wave_format_ex_t wfx;
-                                            br_read(dmux->reader, &wfx, sizeof(wfx));
-                                            info->audio.codec = format_tag_to_audio_codec(wfx.format_tag);
-                                            info->audio.channels = wfx.channels;
-                                            info->audio.sampling_rate = wfx.samples_per_sec;
-                                            info->audio.bits_per_sample = wfx.bits_per_sample;
-                                            info->audio.max_frame_size = strh.suggested_buffer_size;
-                                            LOG_DEBUG("        Audio: format=0x%04x, channels=%u, rate=%u, bits=%u, max_size=%u",
-                                                   (unsigned int)wfx.format_tag, (unsigned int)wfx.channels, (unsigned int)wfx.samples_per_sec,
-                                                   (unsigned int)wfx.bits_per_sample, (unsigned int)strh.suggested_buffer_size);
-                                            // Skip remaining bytes if any
-                                            if (strf_chunk.size > sizeof(wfx)) {
-                                                br_lseek(dmux->reader, strf_chunk.size - sizeof(wfx), SEEK_CUR);
-                                            }
-                                        } else {
-                                            br_lseek(dmux->reader, strf_chunk.size, SEEK_CUR);
-                                        }
-
-                                        // Skip padding for strf
-                                        if (strf_chunk.size & 1) {
-                                            br_lseek(dmux->reader, 1, SEEK_CUR);
-                                        }
-                                    }
-
-                                    // Skip padding for strh
-                                    if (strl_chunk.size & 1) {
-                                        br_lseek(dmux->reader, 1, SEEK_CUR);
-                                    }
-                                } else {
-                                    // Skip unknown chunk in strl
-                                    br_lseek(dmux->reader, strl_chunk.size, SEEK_CUR);
-                                    if (strl_chunk.size & 1) {
-                                        br_lseek(dmux->reader, 1, SEEK_CUR);
-                                    }
-                                }
-                            }
-                        }
-                        // Seek to end of nested LIST
-                        br_lseek(dmux->reader, nested_list_end, SEEK_SET);
-                    } else {
-                        // Skip unknown sub-chunk
-                        br_lseek(dmux->reader, sub_chunk.size, SEEK_CUR);
-                        // Skip padding if needed
-                        if (sub_chunk.size & 1) {
-                            br_lseek(dmux->reader, 1, SEEK_CUR);
-                        }
-                    }
+        } else if (chunk.fourcc == FOURCC_LIST && header.list_type == FOURCC_hdrl) {
+            if (chunk.size < sizeof(fourcc_t)) {
+                LOG_ERROR("Invalid hdrl list size %u", (unsigned int)chunk.size);
+                memory_free(buffer);
+                return false;
+            }
+            size_t list_size = chunk.size - sizeof(fourcc_t);
+            uint64_t list_data = chunk_pos + sizeof(header);
+            riff_cursor_t hdrl = { .data = buffer + list_data, .size = list_size, .position = 0 };
+            uint8_t *list_buffer = NULL;
+            if (list_data + list_size > length) {
+                list_buffer = memory_allocate(list_size);
+                if (!list_buffer) {
+                    LOG_ERROR("Failed to allocate hdrl buffer (%u bytes)", (unsigned int)list_size);
+                    memory_free(buffer);
+                    return false;
                 }
+                br_lseek(dmux->reader, list_data, SEEK_SET);
+                hdrl.data = list_buffer;
+                hdrl.size = br_read(dmux->reader, list_buffer, list_size);
             }
-
-            // Seek to the end of this LIST chunk
-            br_lseek(dmux->reader, list_end, SEEK_SET);
+            parse_hdrl(dmux, info, &hdrl);
+            memory_free(list_buffer);
         } else if (chunk.fourcc == FOURCC_idx1) {
             // Found idx1 chunk
-            info->idx1_location = chunk_pos + 8;  // Data starts after header
+            info->idx1_location = chunk_pos + sizeof(chunk_header_t);  // Data starts after header
             info->idx1_size = chunk.size;
             LOG_DEBUG("Found idx1 chunk at position %lld, size=%u", (long long)info->idx1_location, (unsigned int)chunk.size);
-            // Skip idx1 data for now
-            br_lseek(dmux->reader, chunk.size, SEEK_CUR);
-        } else {
-            // Skip unknown chunks
-            br_lseek(dmux->reader, chunk.size, SEEK_CUR);
         }
+        chunk_pos = chunk_end;
     }
+    memory_free(buffer);
+    return true;
+}
 
-    dmux->info = info;
+avi_dmux_info_t *avi_dmux_parse_info(avi_dmux_t *dmux) {
+    int64_t start_time = os_time_us();
+    avi_dmux_info_t *info = memory_allocate(sizeof(avi_dmux_info_t));
+    if (!info) {
+        LOG_ERROR("Failed to allocate memory for info");
+        return NULL;
+    }
 
-    // Build video frame index from idx1
-    build_video_index(dmux, info);
+    memset(info, 0, sizeof(avi_dmux_info_t));
+    info->video.stream = AVI_DMUX_STREAM_NONE;
+
+    if (avi_index_cache_load(dmux->path, info, dmux->index, AVI_DMUX_MAX_STREAMS)) {
+        dmux->info = info;
+        // The cache keeps the selection of the last open, start over from the first audio stream
+        select_audio_stream(info, 0);
+        update_index_info(dmux, info);
+    } else {
+        bool parsed = parse_riff(dmux, info);
+        select_audio_stream(info, 0);
+        if (!parsed) {
+            memory_free(info);
+            return NULL;
+        }
+        dmux->info = info;
+
+        start_index_build(dmux);
+    }
 
     // Seek to movi data start for frame reading
     br_lseek(dmux->reader, info->movi_location, SEEK_SET);
 
     // Print AVI information
     LOG_INFO("=== AVI File Information ===");
+    LOG_INFO("Open Time:     %.1f ms", (os_time_us() - start_time) / 1000.0);
     LOG_INFO("[Video]");
     LOG_INFO("  Codec:       %s", video_codec_name(info->video.codec));
     LOG_INFO("  Resolution:  %ux%u", (unsigned int)info->video.width, (unsigned int)info->video.height);
@@ -327,6 +823,7 @@ avi_dmux_info_t *avi_dmux_parse_info(avi_dmux_t *dmux) {
     LOG_INFO("  Frame Rate:  %u us/frame (%.2f fps)", (unsigned int)info->video.frame_rate, 1000000.0 / info->video.frame_rate);
     LOG_INFO("  Max Frame Size: %u bytes", (unsigned int)info->video.max_frame_size);
     LOG_INFO("[Audio]");
+    LOG_INFO("  Streams:     %u (%u in the file)", (unsigned int)info->audio_stream_count, (unsigned int)info->stream_count);
     LOG_INFO("  Codec:       %s", audio_codec_name(info->audio.codec));
     LOG_INFO("  Channels:    %u", (unsigned int)info->audio.channels);
     LOG_INFO("  Sample Rate: %u Hz", (unsigned int)info->audio.sampling_rate);
@@ -336,112 +833,328 @@ avi_dmux_info_t *avi_dmux_parse_info(avi_dmux_t *dmux) {
     if (info->idx1_location > 0) {
         LOG_INFO("  idx1 location: %lld", (long long)info->idx1_location);
         LOG_INFO("  idx1 size:     %u bytes", (unsigned int)info->idx1_size);
-        if (info->index.frame_offsets) {
-            LOG_INFO("  Index entries: %u (skip interval: %u)",
-                     (unsigned int)info->index.entry_count,
-                     (unsigned int)info->index.skip_interval);
-        } else {
-            LOG_INFO("  Index: Not built");
-        }
     } else {
         LOG_INFO("  idx1: Not found");
     }
+    if (stream_index(dmux, info->video.stream) && (os_event_group_wait_bits(dmux->index_event, INDEX_EVENT_DONE, false, 0) & INDEX_EVENT_DONE) == 0) {
+        LOG_INFO("  Index: Building in background");
+    } else if (info->index.video_count > 0) {
+        LOG_INFO("  Index entries: %u video, %u audio (%u KB)",
+                 (unsigned int)info->index.video_count, (unsigned int)info->index.audio_count,
+                 (unsigned int)(info->index.memory_size / 1024));
+    } else {
+        LOG_INFO("  Index: Not built");
+    }
 
     br_set_preload_enable(dmux->reader, true);
+    reset_data_rate_window(dmux);
     return info;
 }
 
-bool avi_dmux_read_frame(avi_dmux_t *dmux, avi_dmux_frame_t *frame,
-                           uint8_t *video_buffer, uint32_t video_buffer_size,
-                           uint8_t *audio_buffer, uint32_t audio_buffer_size) {
-    if (!dmux || !dmux->info || !frame) {
-        LOG_ERROR("Invalid parameters");
-        return false;
-    }
+// Normal playback delivers the audio and drops frames. Trick play and scrubbing seek for every frame.
+static bool is_playback(const avi_dmux_t *dmux) {
+    return dmux->frame_step == 1 && !dmux->scrub;
+}
+
+// Stepping backwards and scrubbing only the seek target is read, the next one is anywhere in the file
+static bool reads_target_only(const avi_dmux_t *dmux) {
+    return dmux->frame_step < 0 || dmux->scrub;
+}
 
+// First video frame at or after `number` that avi_dmux_set_frame_drop keeps. Every frame up to the seek
+// target is delivered, and trick play steps on its own.
+static uint32_t kept_video_frame(const avi_dmux_t *dmux, uint32_t number) {
+    if (dmux->frame_drop <= 1 || !is_playback(dmux) || number <= dmux->video_target) return number;
+    uint32_t remainder = number % dmux->frame_drop;
+    return remainder ? number + (dmux->frame_drop - remainder) : number;
+}
+
+// Walk the chunk headers in movi up to the next frame of the video or the selected audio stream.
+// The reader is left at the payload.
+static bool next_chunk_sequential(avi_dmux_t *dmux, avi_dmux_frame_type_t *frame_type, uint32_t *number, uint32_t *size) {
     chunk_header_t chunk;
 
     // Read chunks until we find a video or audio frame
     while (true) {
-        off_t pos = br_lseek(dmux->reader, 0, SEEK_CUR);
+        uint64_t pos = br_lseek(dmux->reader, 0, SEEK_CUR);
         ssize_t bytes_read = br_read(dmux->reader, &chunk, sizeof(chunk));
         if (bytes_read != sizeof(chunk)) {
             LOG_INFO("End of file or read error at position %lld, bytes_read=%zd", (long long)pos, bytes_read);
             return false;  // End of file or read error
         }
 
-        // Check if this is a video frame (00db or 00dc)
-        if (chunk.fourcc == FOURCC_00db || chunk.fourcc == FOURCC_00dc) {
-            if (!video_buffer) {
-                LOG_ERROR("Video buffer is NULL");
-                return false;
-            }
-
-            if (chunk.size > video_buffer_size) {
-                LOG_ERROR("Buffer too small for video frame: %u > %u", (unsigned int)chunk.size, (unsigned int)video_buffer_size);
-                br_lseek(dmux->reader, chunk.size, SEEK_CUR);
-                if (chunk.size & 1) br_lseek(dmux->reader, 1, SEEK_CUR);
-                continue;
-            }
-
-            frame->type = AVI_DMUX_FRAME_TYPE_VIDEO;
-            frame->size = chunk.size;
-            frame->frame_index = dmux->video_frame_count++;
-
-            if (br_read(dmux->reader, video_buffer, chunk.size) != chunk.size) {
-                return false;
+        // Check if this is a video frame ('##db' or '##dc') or an audio frame of the selected stream ('##wb')
+        int stream = data_chunk_stream(chunk.fourcc);
+        bool audio_chunk = chunk_type(chunk.fourcc) == CHUNK_TYPE_wb;
+        avi_dmux_frame_type_t type;
+        if (stream >= 0 && stream == dmux->info->video.stream && !audio_chunk) {
+            type = AVI_DMUX_FRAME_TYPE_VIDEO;
+        } else if (stream >= 0 && stream == dmux->info->audio.stream && audio_chunk && is_playback(dmux)) {
+            type = AVI_DMUX_FRAME_TYPE_AUDIO;
+        }
+        // Step into the next OpenDML 'AVIX' segment and its movi list, and into 'rec ' groups
+        else if (chunk.fourcc == FOURCC_RIFF || chunk.fourcc == FOURCC_LIST) {
+            fourcc_t type;
+            if (br_read(dmux->reader, &type, sizeof(type)) != sizeof(type)) return false;
+            if (type != FOURCC_AVIX && type != FOURCC_movi && type != FOURCC_rec) {
+                br_lseek(dmux->reader, chunk.size > sizeof(type) ? chunk.size - sizeof(type) : 0, SEEK_CUR);
             }
-
+            continue;
+        }
+        // Skip other streams and unknown chunks
+        else {
+            br_lseek(dmux->reader, chunk.size, SEEK_CUR);
             // Skip padding byte if chunk size is odd
             if (chunk.size & 1) {
                 br_lseek(dmux->reader, 1, SEEK_CUR);
             }
+            continue;
+        }
 
-            return true;
+        // Skip the chunks a seek passes over on its way to the video and audio targets, and dropped frames
+        *number = type == AVI_DMUX_FRAME_TYPE_VIDEO ? dmux->video_frame_count++ : dmux->audio_chunk_count++;
+        if (*number < (type == AVI_DMUX_FRAME_TYPE_VIDEO ? dmux->video_keyframe : dmux->audio_target)) {
+            br_lseek(dmux->reader, chunk.size + (chunk.size & 1), SEEK_CUR);
+            continue;
         }
-        // Check if this is an audio frame (01wb)
-        else if (chunk.fourcc == FOURCC_01wb) {
-            if (!audio_buffer) {
-                LOG_ERROR("Audio buffer is NULL");
-                return false;
-            }
+        if (type == AVI_DMUX_FRAME_TYPE_VIDEO && kept_video_frame(dmux, *number) != *number) {
+            dmux->dropped_frames++;
+            br_lseek(dmux->reader, chunk.size + (chunk.size & 1), SEEK_CUR);
+            continue;
+        }
+        *frame_type = type;
+        *size = chunk.size;
+        return true;
+    }
+}
 
-            if (chunk.size > audio_buffer_size) {
-                LOG_ERROR("Buffer too small for audio frame: %u > %u", (unsigned int)chunk.size, (unsigned int)audio_buffer_size);
-                br_lseek(dmux->reader, chunk.size, SEEK_CUR);
-                if (chunk.size & 1) br_lseek(dmux->reader, 1, SEEK_CUR);
-                continue;
-            }
+// Of the next video frame and the next audio chunk, whether the video frame comes first in the file
+static bool video_comes_first(bool video_found, const avi_chunk_t *video, bool audio_found, const avi_chunk_t *audio) {
+    return video_found && (!audio_found || video->offset < audio->offset);
+}
 
-            frame->type = AVI_DMUX_FRAME_TYPE_AUDIO;
-            frame->size = chunk.size;
-            frame->frame_index = 0;  // Not used for audio
+// Video frames in the read-ahead duration
+static uint32_t hint_frames(avi_dmux_t *dmux) {
+    uint32_t frame_rate = dmux->info->video.frame_rate;
+    uint32_t frames = frame_rate > 0 ? (uint64_t)AVI_DMUX_READ_AHEAD_SEC * 1000000 / frame_rate : 0;
+    return frames > AVI_DMUX_HINT_MIN_FRAMES ? frames : AVI_DMUX_HINT_MIN_FRAMES;
+}
 
-            if (br_read(dmux->reader, audio_buffer, chunk.size) != chunk.size) {
-                return false;
-            }
+// Announce the payloads of the next video frames and the audio chunks among them to the reader,
+// so that it loads those instead of everything ahead. Dropped frames are left out. In trick play these
+// are the frames a step apart without audio. Stepping backwards and scrubbing the next target is not
+// ahead of the reader, only the frames up to the current one are announced and the reader does not read ahead.
+static void update_read_hints(avi_dmux_t *dmux, uint32_t video_number, uint32_t audio_number) {
+    br_range_t ranges[BR_HINT_MAX_RANGES];
+    size_t count = 0;
+    uint32_t frames = hint_frames(dmux);
+    uint32_t step = dmux->frame_step > 1 ? dmux->frame_step : 1;
+    uint32_t video_end = reads_target_only(dmux) ? dmux->video_target + 1 : video_number + frames * step;
+    avi_chunk_t video, audio;
+    os_mutex_lock(dmux->index_mutex);
+    avi_chunk_index_t *video_index = stream_index(dmux, dmux->info->video.stream);
+    avi_chunk_index_t *audio_index = stream_index(dmux, dmux->info->audio.stream);
+    bool video_found = avi_chunk_index_get(video_index, video_number, &video);
+    bool audio_found = is_playback(dmux) && audio_index && avi_chunk_index_get(audio_index, audio_number, &audio);
+    for (uint32_t i = 0; i < frames * 4 && (video_found || audio_found); i++) {
+        bool is_video = video_comes_first(video_found, &video, audio_found, &audio);
+        if (is_video && video_number >= video_end) break;
+        const avi_chunk_t *chunk = is_video ? &video : &audio;
+        uint64_t offset = chunk->offset + sizeof(chunk_header_t);
+        // Chunks stored back to back (only their headers between) make one range
+        br_range_t *last = count > 0 ? &ranges[count - 1] : NULL;
+        if (last && offset <= last->offset + last->size + AVI_DMUX_HINT_MERGE_GAP) {
+            last->size = offset + chunk->size - last->offset;
+        } else if (count < BR_HINT_MAX_RANGES) {
+            ranges[count].offset = offset;
+            ranges[count].size = chunk->size;
+            count++;
+        } else {
+            break;
+        }
+        if (is_video) {
+            video_number = kept_video_frame(dmux, video_number + step);
+            video_found = avi_chunk_index_get(video_index, video_number, &video);
+        } else {
+            audio_found = avi_chunk_index_get(audio_index, ++audio_number, &audio);
+        }
+    }
+    os_mutex_unlock(dmux->index_mutex);
+    br_hint_ranges(dmux->reader, ranges, count);
+    // Nothing more is announced until the next seek
+    dmux->hint_video_end = reads_target_only(dmux) ? UINT32_MAX : video_number;
+}
 
-            // Skip padding byte if chunk size is odd
-            if (chunk.size & 1) {
-                br_lseek(dmux->reader, 1, SEEK_CUR);
-            }
+// Take the next frame of the video or the selected audio stream from the indexes, whichever comes
+// first in the file, and move the reader straight to its payload. Headers, other streams and the
+// chunks a seek passes over are never read.
+static bool next_chunk_indexed(avi_dmux_t *dmux, avi_dmux_frame_type_t *frame_type, uint32_t *number, uint32_t *size) {
+    uint32_t next_video = dmux->video_frame_count > dmux->video_keyframe ? dmux->video_frame_count : dmux->video_keyframe;
+    uint32_t video_number = kept_video_frame(dmux, next_video);
+    uint32_t audio_number = dmux->audio_chunk_count > dmux->audio_target ? dmux->audio_chunk_count : dmux->audio_target;
+    // Renew the hints halfway through them, and after a seek
+    if (video_number + hint_frames(dmux) / 2 >= dmux->hint_video_end) update_read_hints(dmux, video_number, audio_number);
+    avi_chunk_t video, audio;
+    os_mutex_lock(dmux->index_mutex);
+    avi_chunk_index_t *audio_index = stream_index(dmux, dmux->info->audio.stream);
+    bool video_found = avi_chunk_index_get(stream_index(dmux, dmux->info->video.stream), video_number, &video);
+    bool audio_found = is_playback(dmux) && audio_index && avi_chunk_index_get(audio_index, audio_number, &audio);
+    os_mutex_unlock(dmux->index_mutex);
+    if (!video_found && !audio_found) {
+        LOG_INFO("End of index at video frame %u, audio chunk %u", (unsigned int)video_number, (unsigned int)audio_number);
+        return false;
+    }
+
+    avi_chunk_t *chunk;
+    if (video_comes_first(video_found, &video, audio_found, &audio)) {
+        *frame_type = AVI_DMUX_FRAME_TYPE_VIDEO;
+        *number = video_number;
+        dmux->video_frame_count = video_number + 1;
+        dmux->dropped_frames += video_number - next_video;
+        chunk = &video;
+    } else {
+        *frame_type = AVI_DMUX_FRAME_TYPE_AUDIO;
+        *number = audio_number;
+        dmux->audio_chunk_count = audio_number + 1;
+        chunk = &audio;
+    }
+    *size = chunk->size;
+    br_lseek(dmux->reader, chunk->offset + sizeof(chunk_header_t), SEEK_SET);
+    return true;
+}
+
+// Frames are read by index once it is complete, by walking movi until then
+static bool use_index(avi_dmux_t *dmux) {
+    if (dmux->index_driven || !AVI_DMUX_INDEX_DRIVEN) return dmux->index_driven;
+    if (!(os_event_group_wait_bits(dmux->index_event, INDEX_EVENT_DONE, false, 0) & INDEX_EVENT_DONE)) return false;
+    os_mutex_lock(dmux->index_mutex);
+    avi_chunk_index_t *index = stream_index(dmux, dmux->info->video.stream);
+    dmux->index_driven = index && avi_chunk_index_count(index) > 0;
+    os_mutex_unlock(dmux->index_mutex);
+    if (dmux->index_driven) LOG_INFO("Reading frames by index");
+    return dmux->index_driven;
+}
+
+static bool read_frame(avi_dmux_t *dmux, avi_dmux_frame_t *frame, br_span_t *payload,
+                       uint8_t *video_buffer, uint32_t video_buffer_size,
+                       uint8_t *audio_buffer, uint32_t audio_buffer_size) {
+    if (!dmux || !dmux->info || !frame) {
+        LOG_ERROR("Invalid parameters");
+        return false;
+    }
 
-            return true;
+    while (true) {
+        avi_dmux_frame_type_t type;
+        uint32_t number, size;
+        bool found = use_index(dmux) ? next_chunk_indexed(dmux, &type, &number, &size)
+                                     : next_chunk_sequential(dmux, &type, &number, &size);
+        if (!found) return false;
+
+        uint8_t *buffer = type == AVI_DMUX_FRAME_TYPE_VIDEO ? video_buffer : audio_buffer;
+        uint32_t buffer_size = type == AVI_DMUX_FRAME_TYPE_VIDEO ? video_buffer_size : audio_buffer_size;
+        if (!buffer) {
+            LOG_ERROR("%s buffer is NULL", type == AVI_DMUX_FRAME_TYPE_VIDEO ? "Video" : "Audio");
+            return false;
         }
-        // Skip unknown chunks
-        else {
-            br_lseek(dmux->reader, chunk.size, SEEK_CUR);
-            // Skip padding byte if chunk size is odd
-            if (chunk.size & 1) {
-                br_lseek(dmux->reader, 1, SEEK_CUR);
+        if (size > buffer_size) {
+            LOG_ERROR("Buffer too small for %s frame: %u > %u", type == AVI_DMUX_FRAME_TYPE_VIDEO ? "video" : "audio",
+                      (unsigned int)size, (unsigned int)buffer_size);
+            br_lseek(dmux->reader, size + (size & 1), SEEK_CUR);
+            continue;
+        }
+
+        frame->type = type;
+        frame->size = size;
+        frame->frame_index = number;
+        frame->drop_samples = type == AVI_DMUX_FRAME_TYPE_AUDIO && number == dmux->audio_target ? dmux->audio_drop_samples : 0;
+        frame->decode_only = type == AVI_DMUX_FRAME_TYPE_VIDEO && number < dmux->video_target;
+        frame->dropped_frames = 0;
+        if (type == AVI_DMUX_FRAME_TYPE_VIDEO) {
+            frame->dropped_frames = dmux->dropped_frames;
+            dmux->dropped_frames = 0;
+        }
+        if (type == AVI_DMUX_FRAME_TYPE_VIDEO) update_data_rate(dmux);
+
+        // Borrow the payload from the preloaded chunks if possible, otherwise copy it into the buffer
+        if (!payload || !br_peek(dmux->reader, size, payload)) {
+            if (br_read(dmux->reader, buffer, size) != size) {
+                return false;
+            }
+            if (payload) {
+                payload->segments[0].data = buffer;
+                payload->segments[0].size = size;
+                payload->segment_count = 1;
+                payload->pinned_count = 0;
             }
         }
+
+        // Skip padding byte if chunk size is odd
+        if (size & 1) {
+            br_lseek(dmux->reader, 1, SEEK_CUR);
+        }
+
+        return true;
     }
 }
 
+bool avi_dmux_read_frame(avi_dmux_t *dmux, avi_dmux_frame_t *frame,
+                           uint8_t *video_buffer, uint32_t video_buffer_size,
+                           uint8_t *audio_buffer, uint32_t audio_buffer_size) {
+    return read_frame(dmux, frame, NULL, video_buffer, video_buffer_size, audio_buffer, audio_buffer_size);
+}
+
+bool avi_dmux_peek_frame(avi_dmux_t *dmux, avi_dmux_frame_t *frame, br_span_t *payload,
+                         uint8_t *video_buffer, uint32_t video_buffer_size,
+                         uint8_t *audio_buffer, uint32_t audio_buffer_size) {
+    if (!payload) {
+        LOG_ERROR("Invalid parameters");
+        return false;
+    }
+    return read_frame(dmux, frame, payload, video_buffer, video_buffer_size, audio_buffer, audio_buffer_size);
+}
+
+void avi_dmux_release_frame(avi_dmux_t *dmux, br_span_t *payload) {
+    br_release(dmux->reader, payload);
+}
+
 void avi_dmux_seek_to_start(avi_dmux_t *dmux) {
     br_lseek(dmux->reader, dmux->info->movi_location, SEEK_SET);
+    dmux->hint_video_end = 0;
     dmux->video_frame_count = 0;
+    dmux->audio_chunk_count = 0;
+    dmux->video_keyframe = 0;
+    dmux->video_target = 0;
+    dmux->audio_target = 0;
+    dmux->audio_drop_samples = 0;
+    dmux->dropped_frames = 0;
+    reset_data_rate_window(dmux);
+}
+
+// Sample (at the sampling rate) where an audio chunk starts playing
+static uint64_t audio_chunk_start_sample(const avi_dmux_info_t *info, uint32_t number, const avi_chunk_t *chunk) {
+    uint64_t units = info->audio.sample_size > 0 ? chunk->position / info->audio.sample_size : number;
+    return units * info->audio.scale * info->audio.sampling_rate / info->audio.rate;
+}
+
+// Audio chunk that plays at `time` (in units of 1 / `time_base` seconds), and the samples of it before
+// that time. Called with index_mutex held.
+static bool find_audio_chunk(avi_dmux_t *dmux, uint64_t time, uint64_t time_base, uint32_t *number, avi_chunk_t *chunk, uint32_t *drop_samples) {
+    const avi_dmux_info_t *info = dmux->info;
+    avi_chunk_index_t *index = stream_index(dmux, info->audio.stream);
+    if (!index || info->audio.scale == 0 || info->audio.rate == 0 || info->audio.sampling_rate == 0) return false;
+
+    // strh units are samples in a CBR stream and chunks in a VBR stream
+    uint64_t units = time * info->audio.rate / (info->audio.scale * time_base);
+    if (info->audio.sample_size > 0) {
+        if (!avi_chunk_index_find_position(index, units * info->audio.sample_size, number, chunk)) return false;
+    } else {
+        if (units > UINT32_MAX || !avi_chunk_index_get(index, units, chunk)) return false;
+        *number = units;
+    }
+    uint64_t target = time * info->audio.sampling_rate / time_base;
+    uint64_t start = audio_chunk_start_sample(info, *number, chunk);
+    *drop_samples = target > start ? target - start : 0;
+    return true;
 }
 
 bool avi_dmux_seek_to_frame(avi_dmux_t *dmux, uint32_t frame_number) {
@@ -450,33 +1163,150 @@ bool avi_dmux_seek_to_frame(avi_dmux_t *dmux, uint32_t frame_number) {
         return false;
     }
 
-    if (!dmux->info->index.frame_offsets) {
+    // The index may still be building, wait a little for the part that covers the frame
+    wait_index(dmux, frame_number);
+    avi_chunk_t chunk, audio_chunk;
+    uint32_t audio_number = 0, drop_samples = 0;
+    os_mutex_lock(dmux->index_mutex);
+    const avi_dmux_info_t *info = dmux->info;
+    avi_chunk_index_t *index = stream_index(dmux, info->video.stream);
+    avi_chunk_index_t *audio_index = stream_index(dmux, info->audio.stream);
+    bool found = index && frame_number < avi_chunk_index_count(index);
+    uint32_t indexed_frames = index ? avi_chunk_index_count(index) : 0;
+    // Decoding starts at a keyframe, every frame is one for intra-only codecs
+    uint32_t keyframe = frame_number;
+    if (found && !video_codec_is_intra_only(info->video.codec)) keyframe = avi_chunk_index_find_keyframe(index, frame_number);
+    if (found) avi_chunk_index_get(index, keyframe, &chunk);
+    // strh has the exact frame duration, avih only whole microseconds
+    bool exact = info->video.scale > 0 && info->video.rate > 0;
+    uint64_t time = (uint64_t)frame_number * (exact ? info->video.scale : info->video.frame_rate);
+    bool audio_found = found && is_playback(dmux) &&
+                       find_audio_chunk(dmux, time, exact ? info->video.rate : 1000000, &audio_number, &audio_chunk, &drop_samples);
+    // Start reading at whichever of the two comes first: with coarse interleaving the audio of the
+    // frame's time may be stored well before it. The counters restart from the chunks there.
+    uint64_t start = found ? chunk.offset : 0;
+    if (audio_found && audio_chunk.offset < start) start = audio_chunk.offset;
+    uint32_t video_count = found ? avi_chunk_index_find_offset(index, start) : 0;
+    uint32_t audio_count = found && audio_index ? avi_chunk_index_find_offset(audio_index, start) : 0;
+    os_mutex_unlock(dmux->index_mutex);
+    if (!index) {
         LOG_ERROR("Index not available, cannot seek");
         return false;
     }
+    if (!found) {
+        LOG_ERROR("Frame %u out of range (indexed frames: %u)", (unsigned int)frame_number, (unsigned int)indexed_frames);
+        return false;
+    }
+
+    br_lseek(dmux->reader, start, SEEK_SET);
+
+    // Update the counters and the targets of the chunks to skip
+    dmux->hint_video_end = 0;
+    dmux->video_frame_count = video_count;
+    dmux->audio_chunk_count = audio_count;
+    dmux->video_keyframe = keyframe;
+    dmux->video_target = frame_number;
+    dmux->audio_target = audio_found ? audio_number : audio_count;
+    dmux->audio_drop_samples = audio_found ? drop_samples : 0;
+    dmux->dropped_frames = 0;
+    reset_data_rate_window(dmux);
 
-    // Convert actual frame number to index entry number
-    uint32_t index_entry = frame_number / dmux->info->index.skip_interval;
+    LOG_DEBUG("Seeked to frame %u (keyframe %u at %lld), audio chunk %u + %u samples, from %lld",
+              (unsigned int)frame_number, (unsigned int)keyframe, (long long)chunk.offset,
+              (unsigned int)dmux->audio_target, (unsigned int)dmux->audio_drop_samples, (long long)start);
 
-    if (index_entry >= dmux->info->index.entry_count) {
-        LOG_ERROR("Frame %u out of range (max index entry: %u)",
-                  (unsigned int)frame_number, (unsigned int)(dmux->info->index.entry_count - 1));
+    return true;
+}
+
+bool avi_dmux_seek_to_time(avi_dmux_t *dmux, uint64_t time_us) {
+    if (!dmux || !dmux->info) {
+        LOG_ERROR("Invalid dmux or info");
         return false;
     }
+    const avi_dmux_info_t *info = dmux->info;
+    uint64_t frame_number;
+    if (info->video.scale > 0 && info->video.rate > 0) {
+        frame_number = time_us * info->video.rate / ((uint64_t)info->video.scale * 1000000);
+    } else if (info->video.frame_rate > 0) {
+        frame_number = time_us / info->video.frame_rate;
+    } else {
+        LOG_ERROR("Unknown frame rate, cannot seek to %llu us", (unsigned long long)time_us);
+        return false;
+    }
+    return avi_dmux_seek_to_frame(dmux, frame_number > UINT32_MAX ? UINT32_MAX : (uint32_t)frame_number);
+}
 
-    // Get offset from index
-    uint32_t offset = dmux->info->index.frame_offsets[index_entry];
-
-    // Seek to the frame position
-    // Note: offset is relative to 'movi' FourCC (4 bytes before movi_location)
-    off_t target_pos = dmux->info->movi_location - 4 + offset;
-    br_lseek(dmux->reader, target_pos, SEEK_SET);
+bool avi_dmux_set_frame_drop(avi_dmux_t *dmux, uint32_t interval) {
+    if (!dmux || !dmux->info) {
+        LOG_ERROR("Invalid dmux or info");
+        return false;
+    }
+    if (interval == 0) interval = 1;
+    if (interval > 1 && !video_codec_is_intra_only(dmux->info->video.codec)) return false;
+    if (interval != dmux->frame_drop) {
+        dmux->frame_drop = interval;
+        // Re-announce what is ahead, the read-ahead has not reached most of it yet
+        dmux->hint_video_end = 0;
+    }
+    return true;
+}
 
-    // Update video frame counter
-    dmux->video_frame_count = (index_entry * dmux->info->index.skip_interval);
+void avi_dmux_set_frame_step(avi_dmux_t *dmux, int32_t step) {
+    if (!dmux) {
+        LOG_ERROR("Invalid dmux");
+        return;
+    }
+    dmux->frame_step = step != 0 ? step : 1;
+    dmux->hint_video_end = 0;
+    br_set_read_ahead(dmux->reader, !reads_target_only(dmux));
+}
 
-    LOG_DEBUG("Seeked to frame %u (index entry %u, offset %u, pos %lld)",
-              (unsigned int)frame_number, (unsigned int)index_entry, (unsigned int)offset, (long long)target_pos);
+void avi_dmux_set_scrub(avi_dmux_t *dmux, bool enable) {
+    if (!dmux) {
+        LOG_ERROR("Invalid dmux");
+        return;
+    }
+    if (enable == dmux->scrub) return;
+    dmux->scrub = enable;
+    dmux->hint_video_end = 0;
+    br_set_read_ahead(dmux->reader, !reads_target_only(dmux));
+}
 
+bool avi_dmux_select_audio_stream(avi_dmux_t *dmux, uint32_t number) {
+    if (!dmux || !dmux->info || number >= dmux->info->audio_stream_count) {
+        LOG_ERROR("Invalid audio stream %u", (unsigned int)number);
+        return false;
+    }
+    avi_dmux_info_t *info = dmux->info;
+    if (number == info->audio_stream_selected) return true;
+    os_mutex_lock(dmux->index_mutex);
+    select_audio_stream(info, number);
+    update_index_info(dmux, info);
+    os_mutex_unlock(dmux->index_mutex);
+    LOG_INFO("Audio stream %u selected (stream number %u, %s)", (unsigned int)number, (unsigned int)info->audio.stream,
+             audio_codec_name(info->audio.codec));
+
+    // The chunk counter of the new stream comes from the index: seek to the next video frame, which
+    // also places the new stream's audio at that frame's time
+    uint32_t frame_number = dmux->video_frame_count > dmux->video_target ? dmux->video_frame_count : dmux->video_target;
+    if (!avi_dmux_seek_to_frame(dmux, frame_number)) {
+        LOG_INFO("Audio stream %u continues without its position", (unsigned int)number);
+        dmux->audio_chunk_count = 0;
+        dmux->audio_target = 0;
+        dmux->audio_drop_samples = 0;
+    }
     return true;
 }
+
+bool avi_dmux_get_index_progress(avi_dmux_t *dmux, uint32_t *indexed_frames) {
+    bool done = os_event_group_wait_bits(dmux->index_event, INDEX_EVENT_DONE, false, 0) & INDEX_EVENT_DONE;
+    os_mutex_lock(dmux->index_mutex);
+    avi_chunk_index_t *index = stream_index(dmux, dmux->info->video.stream);
+    if (indexed_frames) *indexed_frames = index ? avi_chunk_index_count(index) : 0;
+    os_mutex_unlock(dmux->index_mutex);
+    return done;
+}
+
+void avi_dmux_get_reader_stats(avi_dmux_t *dmux, br_stats_t *stats) {
+    br_get_stats(dmux->reader, stats);
+}
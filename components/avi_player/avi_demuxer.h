@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "buffered_reader.h"
 
 typedef enum {
     AVI_DMUX_AUDIO_CODEC_UNKNOWN,
@@ -16,14 +17,31 @@ typedef enum {
     AVI_DMUX_VIDEO_CODEC_MJPEG,
 } avi_dmux_video_codec_t;
 
+#ifndef AVI_DMUX_MAX_STREAMS
+#define AVI_DMUX_MAX_STREAMS (8)        // Chunks of higher stream numbers are skipped
+#endif
+#ifndef AVI_DMUX_MAX_AUDIO_STREAMS
+#define AVI_DMUX_MAX_AUDIO_STREAMS (4)
+#endif
+#define AVI_DMUX_STREAM_NONE (0xFF)
+
 typedef struct {
-    struct {
-        avi_dmux_audio_codec_t codec;
-        uint8_t channels;
-        uint8_t bits_per_sample;
-        uint32_t sampling_rate;
-        uint32_t max_frame_size;
-    } audio;
+    avi_dmux_audio_codec_t codec;
+    uint8_t channels;
+    uint8_t bits_per_sample;
+    uint32_t sampling_rate;
+    uint32_t max_frame_size;
+    // Stream timing from strh: a chunk of a VBR stream (sample_size 0) lasts scale / rate seconds,
+    // in a CBR stream every sample_size bytes do
+    uint32_t scale;
+    uint32_t rate;
+    uint32_t sample_size;
+    uint16_t block_align;
+    uint8_t stream;     // Stream number, the '##' of its '##wb' chunks (AVI_DMUX_STREAM_NONE without audio)
+} avi_dmux_audio_info_t;
+
+typedef struct {
+    avi_dmux_audio_info_t audio;  // The selected audio stream
     struct {
         avi_dmux_video_codec_t codec;
         uint32_t width;
@@ -31,14 +49,22 @@ typedef struct {
         uint32_t total_frames;
         uint32_t frame_rate;  // micro seconds per frame
         uint32_t max_frame_size;
+        // Exact frame duration from strh: scale / rate seconds
+        uint32_t scale;
+        uint32_t rate;
+        uint8_t stream;     // Stream number of the first video stream
     } video;
-    off_t movi_location;
-    off_t idx1_location;
+    uint8_t stream_count;           // strl lists in hdrl
+    uint8_t audio_stream_count;
+    uint8_t audio_stream_selected;  // Which of audio_streams is delivered as `audio`
+    avi_dmux_audio_info_t audio_streams[AVI_DMUX_MAX_AUDIO_STREAMS];
+    uint64_t movi_location;
+    uint64_t idx1_location;
     uint32_t idx1_size;
     struct {
-        uint32_t *frame_offsets;  // Video frame offsets from movi start
-        uint32_t entry_count;     // Number of entries actually stored
-        uint32_t skip_interval;   // 1=all frames, 2=every 2nd frame, etc
+        uint32_t video_count;     // Video chunks in the index (0 = not available or still building)
+        uint32_t audio_count;     // Audio chunks in the index
+        uint32_t memory_size;     // Bytes used by the compressed index
     } index;
 } avi_dmux_info_t;
 
@@ -50,15 +76,58 @@ typedef enum {
 typedef struct {
     avi_dmux_frame_type_t type;
     uint32_t size;
-    uint32_t frame_index;  // For video frames
+    uint32_t frame_index;   // Video frame number, or audio chunk number
+    uint32_t drop_samples;  // Audio samples at the start of the chunk that precede the seek target
+    bool decode_only;       // Video frame between the keyframe and the seek target: decode, do not display
+    uint32_t dropped_frames;    // Video frames left out right before this one by avi_dmux_set_frame_drop
 } avi_dmux_frame_t;
 
 typedef struct avi_dmux avi_dmux_t;
 avi_dmux_t *avi_dmux_create(const char *file);
+// `config` NULL sizes the read-ahead ring from the file's data rate (avih.max_bytes_per_sec)
+avi_dmux_t *avi_dmux_create_ex(const char *file, const br_config_t *config);
+// The reader config avi_dmux_create uses for `file`, as a base for overrides. Returns the data rate
+// it was sized for, 0 when unknown (the ring size is left as it was).
+uint32_t avi_dmux_reader_config(const char *file, br_config_t *config);
 void avi_dmux_delete(avi_dmux_t *dmux);
 avi_dmux_info_t *avi_dmux_parse_info(avi_dmux_t *dmux);
 bool avi_dmux_read_frame(avi_dmux_t *dmux, avi_dmux_frame_t *frame,
                          uint8_t *video_buffer, uint32_t video_buffer_size,
                          uint8_t *audio_buffer, uint32_t audio_buffer_size);
+// Zero-copy variant of avi_dmux_read_frame. `payload` points directly into the reader's
+// preloaded chunks (split in two segments when crossing a chunk boundary) and stays valid
+// until avi_dmux_release_frame. If the frame is not preloaded it is copied into the given
+// buffer and `payload` refers to that buffer instead.
+bool avi_dmux_peek_frame(avi_dmux_t *dmux, avi_dmux_frame_t *frame, br_span_t *payload,
+                         uint8_t *video_buffer, uint32_t video_buffer_size,
+                         uint8_t *audio_buffer, uint32_t audio_buffer_size);
+void avi_dmux_release_frame(avi_dmux_t *dmux, br_span_t *payload);
 void avi_dmux_seek_to_start(avi_dmux_t *dmux);
+// Reading resumes at the video frame and at the audio chunk that plays at its time, whichever comes
+// first in the file. Chunks before either target are skipped, and the first audio frame reports the
+// samples to drop in `drop_samples`. Codecs with inter frames restart at the preceding keyframe, the
+// frames up to the target come with `decode_only`.
 bool avi_dmux_seek_to_frame(avi_dmux_t *dmux, uint32_t frame_number);
+// Seek to the video frame shown at `time_us`, audio follows that frame's time
+bool avi_dmux_seek_to_time(avi_dmux_t *dmux, uint64_t time_us);
+// Deliver only every `interval`-th video frame from now on, 1 for all of them. The audio is delivered
+// as usual. The dropped frames are left out of the reader hints, so a reader chunk that only they cover
+// is not loaded once the read-ahead gets there. Only for intra-only codecs, false if later frames may
+// refer to the dropped ones.
+bool avi_dmux_set_frame_drop(avi_dmux_t *dmux, uint32_t interval);
+// Trick play: the player seeks `step` video frames ahead (or back when negative) for every frame it
+// shows. Audio is not delivered and the reader is told only about the frames a step apart. Stepping back
+// only the seek target is read, without read-ahead. 1 for normal playback, seek afterwards to resume
+// with audio.
+void avi_dmux_set_frame_step(avi_dmux_t *dmux, int32_t step);
+// Scrubbing: the player seeks anywhere for every preview frame. Only the seek target is read, without
+// audio and without read-ahead, until it is disabled. Seek afterwards to resume with audio.
+void avi_dmux_set_scrub(avi_dmux_t *dmux, bool enable);
+// Deliver the audio stream audio_streams[number] from now on, the others are skipped. Reading resumes
+// from the next video frame with the new stream's audio for that time. Call it from the reading task.
+bool avi_dmux_select_audio_stream(avi_dmux_t *dmux, uint32_t number);
+// The index is built in the background after avi_dmux_parse_info. Returns true once the build has
+// ended, `indexed_frames` (optional) receives the number of video frames seekable so far.
+// avi_dmux_seek_to_frame waits up to AVI_DMUX_INDEX_WAIT_MS for a frame that is not indexed yet.
+bool avi_dmux_get_index_progress(avi_dmux_t *dmux, uint32_t *indexed_frames);
+void avi_dmux_get_reader_stats(avi_dmux_t *dmux, br_stats_t *stats);
@@ -0,0 +1,130 @@
+#include "avi_index_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_log.h"
+static const char *TAG = "avi_index_cache";
+#define LOG_ERROR(fmt, ...) ESP_LOGE(TAG, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) ESP_LOGI(TAG, fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...) printf("\e[31mE: "fmt"\e[m\n", ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) printf("I: "fmt"\n", ##__VA_ARGS__)
+#endif
+
+#define AVI_INDEX_CACHE_MAGIC   (0x58495641)  // "AVIX"
+#define AVI_INDEX_CACHE_VERSION (4)
+#define AVI_INDEX_CACHE_SUFFIX  "x"
+
+// File layout: header, avi_dmux_info_t, then index_num serialized avi_chunk_index_t
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t info_size;     // sizeof(avi_dmux_info_t) of the build that wrote it
+    uint64_t file_size;     // Size and mtime of the AVI file
+    int64_t file_mtime;
+    uint32_t index_num;
+    uint32_t reserved;
+} avi_index_cache_header_t;
+
+static char *cache_path(const char *avi_path) {
+    size_t length = strlen(avi_path);
+    char *path = malloc(length + sizeof(AVI_INDEX_CACHE_SUFFIX));
+    if (!path) return NULL;
+    memcpy(path, avi_path, length);
+    memcpy(path + length, AVI_INDEX_CACHE_SUFFIX, sizeof(AVI_INDEX_CACHE_SUFFIX));
+    return path;
+}
+
+static bool stat_avi(const char *avi_path, avi_index_cache_header_t *header) {
+    struct stat st;
+    if (stat(avi_path, &st)) return false;
+    memset(header, 0, sizeof(*header));
+    header->magic = AVI_INDEX_CACHE_MAGIC;
+    header->version = AVI_INDEX_CACHE_VERSION;
+    header->info_size = sizeof(avi_dmux_info_t);
+    header->file_size = st.st_size;
+    header->file_mtime = st.st_mtime;
+    return true;
+}
+
+bool avi_index_cache_load(const char *avi_path, avi_dmux_info_t *info, avi_chunk_index_t **indexes, int index_num) {
+    avi_index_cache_header_t expected;
+    if (!stat_avi(avi_path, &expected)) return false;
+    char *path = cache_path(avi_path);
+    if (!path) return false;
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) return false;
+
+    // Header and info in one read, then each index straight into its final arrays
+    struct {
+        avi_index_cache_header_t header;
+        avi_dmux_info_t info;
+    } cache;
+    bool loaded = false;
+    if (read(fd, &cache, sizeof(cache)) != sizeof(cache)) {
+        LOG_ERROR("Index cache truncated");
+    } else if (cache.header.magic != expected.magic || cache.header.version != expected.version ||
+               cache.header.info_size != expected.info_size || cache.header.index_num != (uint32_t)index_num) {
+        LOG_INFO("Index cache format changed, rebuilding");
+    } else if (cache.header.file_size != expected.file_size || cache.header.file_mtime != expected.file_mtime) {
+        LOG_INFO("Index cache is stale, rebuilding");
+    } else {
+        loaded = true;
+        for (int i = 0; i < index_num && loaded; i++) {
+            indexes[i] = avi_chunk_index_read(fd);
+            loaded = indexes[i] != NULL;
+        }
+        if (loaded) {
+            *info = cache.info;
+            LOG_INFO("Loaded index cache");
+        } else {
+            LOG_ERROR("Failed to read index cache entries");
+            for (int i = 0; i < index_num; i++) {
+                avi_chunk_index_delete(indexes[i]);
+                indexes[i] = NULL;
+            }
+        }
+    }
+    close(fd);
+    return loaded;
+}
+
+void avi_index_cache_save(const char *avi_path, const avi_dmux_info_t *info, avi_chunk_index_t *const *indexes, int index_num) {
+    struct {
+        avi_index_cache_header_t header;
+        avi_dmux_info_t info;
+    } cache;
+    memset(&cache, 0, sizeof(cache));
+    if (!stat_avi(avi_path, &cache.header)) return;
+    cache.header.index_num = index_num;
+    cache.info = *info;
+    for (int i = 0; i < index_num; i++) {
+        if (!indexes[i]) return;
+    }
+
+    char *path = cache_path(avi_path);
+    if (!path) return;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        // Read-only media, keep working without the cache
+        LOG_INFO("Cannot create index cache %s", path);
+        free(path);
+        return;
+    }
+    bool written = write(fd, &cache, sizeof(cache)) == sizeof(cache);
+    for (int i = 0; i < index_num && written; i++) {
+        written = avi_chunk_index_write(indexes[i], fd);
+    }
+    close(fd);
+    if (!written) {
+        LOG_ERROR("Failed to write index cache %s", path);
+        unlink(path);
+    }
+    free(path);
+}
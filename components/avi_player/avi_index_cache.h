@@ -0,0 +1,10 @@
+#pragma once
+#include <stdbool.h>
+#include "avi_demuxer.h"
+#include "avi_chunk_index.h"
+
+// Sidecar cache of the parsed header and index, stored next to the AVI file as "<file>x"
+// ("movie.avi" -> "movie.avix"). Validated by the size and mtime of the AVI file.
+// `indexes` receives `index_num` chunk indexes, owned by the caller on success.
+bool avi_index_cache_load(const char *avi_path, avi_dmux_info_t *info, avi_chunk_index_t **indexes, int index_num);
+void avi_index_cache_save(const char *avi_path, const avi_dmux_info_t *info, avi_chunk_index_t *const *indexes, int index_num);
@@ -14,16 +14,37 @@ typedef enum {
     FOURCC_strl = FOURCC('s', 't', 'r', 'l'),
     FOURCC_movi = FOURCC('m', 'o', 'v', 'i'),
     FOURCC_idx1 = FOURCC('i', 'd', 'x', '1'),
+    FOURCC_AVIX = FOURCC('A', 'V', 'I', 'X'),
+    FOURCC_indx = FOURCC('i', 'n', 'd', 'x'),
+    FOURCC_odml = FOURCC('o', 'd', 'm', 'l'),
+    FOURCC_dmlh = FOURCC('d', 'm', 'l', 'h'),
+    FOURCC_rec  = FOURCC('r', 'e', 'c', ' '),
     FOURCC_vids = FOURCC('v', 'i', 'd', 's'),
     FOURCC_auds = FOURCC('a', 'u', 'd', 's'),
-    FOURCC_00db = FOURCC('0', '0', 'd', 'b'),
-    FOURCC_00dc = FOURCC('0', '0', 'd', 'c'),
-    FOURCC_01wb = FOURCC('0', '1', 'w', 'b'),
     FOURCC_JUNK = FOURCC('J', 'U', 'N', 'K'),
     FOURCC_MJPG = FOURCC('M', 'J', 'P', 'G'),
     FOURCC_mjpg = FOURCC('m', 'j', 'p', 'g'),
 } fourcc_t;
 
+// Stream data chunks are '##xx': the stream number in two digits and the data type
+#define CHUNK_TYPE(a, b) ((uint16_t)(a) | ((uint16_t)(b) << 8))
+typedef enum {
+    CHUNK_TYPE_db = CHUNK_TYPE('d', 'b'),  // Uncompressed video frame
+    CHUNK_TYPE_dc = CHUNK_TYPE('d', 'c'),  // Compressed video frame
+    CHUNK_TYPE_wb = CHUNK_TYPE('w', 'b'),  // Audio data
+} chunk_type_t;
+
+// Stream number of a '##xx' chunk ID, -1 for other chunks
+inline static int chunk_stream_number(fourcc_t fourcc) {
+    uint8_t tens = fourcc & 0xFF, ones = (fourcc >> 8) & 0xFF;
+    if (tens < '0' || tens > '9' || ones < '0' || ones > '9') return -1;
+    return (tens - '0') * 10 + (ones - '0');
+}
+
+inline static chunk_type_t chunk_type(fourcc_t fourcc) {
+    return (chunk_type_t)(fourcc >> 16);
+}
+
 // AVI file structures
 typedef struct {
     fourcc_t fourcc;
@@ -98,9 +119,98 @@ typedef struct {
     uint32_t size;        // Chunk size
 } __attribute__((packed)) avi_index_entry_t;
 
-// Maximum number of index entries to keep in memory
-#ifndef AVI_DMUX_MAX_INDEX_ENTRIES
-#define AVI_DMUX_MAX_INDEX_ENTRIES 36000
+#define AVIIF_KEYFRAME (0x00000010)
+
+// OpenDML (AVI 2.0) indexes
+#define AVI_INDEX_OF_INDEXES (0x00)
+#define AVI_INDEX_OF_CHUNKS  (0x01)
+#define AVI_INDEX_DELTA_FRAME (0x80000000)  // Set in the size of a standard index entry for non-keyframes
+
+// 'indx' in strl: super index pointing to the 'ix##' chunks of the stream
+typedef struct {
+    uint16_t longs_per_entry;   // 4
+    uint8_t index_sub_type;
+    uint8_t index_type;         // AVI_INDEX_OF_INDEXES
+    uint32_t entries_in_use;
+    fourcc_t chunk_id;
+    uint32_t reserved[3];
+} __attribute__((packed)) avi_super_index_header_t;
+
+typedef struct {
+    uint64_t offset;            // File offset of the 'ix##' chunk header
+    uint32_t size;
+    uint32_t duration;
+} __attribute__((packed)) avi_super_index_entry_t;
+
+// 'ix##' in movi: standard index of the chunks of one stream in one RIFF segment
+typedef struct {
+    uint16_t longs_per_entry;   // 2
+    uint8_t index_sub_type;
+    uint8_t index_type;         // AVI_INDEX_OF_CHUNKS
+    uint32_t entries_in_use;
+    fourcc_t chunk_id;
+    uint64_t base_offset;
+    uint32_t reserved;
+} __attribute__((packed)) avi_std_index_header_t;
+
+typedef struct {
+    uint32_t offset;            // Offset of the chunk data (after its header) from base_offset
+    uint32_t size;              // Data size, AVI_INDEX_DELTA_FRAME for non-keyframes
+} __attribute__((packed)) avi_std_index_entry_t;
+
+// The file header (RIFF, hdrl and usually the start of movi) is read at once in a block of this size
+#ifndef AVI_DMUX_HEADER_READ_SIZE
+#define AVI_DMUX_HEADER_READ_SIZE (16 * 1024)
+#endif
+
+// idx1 is read in batches of this size when building the index
+#ifndef AVI_DMUX_INDEX_BATCH_SIZE
+#define AVI_DMUX_INDEX_BATCH_SIZE (64 * 1024)
+#endif
+
+// Background index build
+#ifndef AVI_DMUX_INDEX_TASK_PRIORITY
+#define AVI_DMUX_INDEX_TASK_PRIORITY 1
+#endif
+#ifndef AVI_DMUX_INDEX_TASK_CORE
+#define AVI_DMUX_INDEX_TASK_CORE 0
+#endif
+#ifndef AVI_DMUX_INDEX_WAIT_MS
+#define AVI_DMUX_INDEX_WAIT_MS 1000  // Longest wait of a seek for the part of the index that covers it
+#endif
+
+// Read frames by their index entries instead of walking the chunk headers, once the index is complete
+#ifndef AVI_DMUX_INDEX_DRIVEN
+#define AVI_DMUX_INDEX_DRIVEN 1
+#endif
+
+// In index mode the payloads of the video frames within the read-ahead (at least AVI_DMUX_HINT_MIN_FRAMES)
+// and the audio among them are passed to the reader as br_hint_ranges; ranges closer than the merge gap are joined
+#ifndef AVI_DMUX_HINT_MIN_FRAMES
+#define AVI_DMUX_HINT_MIN_FRAMES 16
+#endif
+#ifndef AVI_DMUX_HINT_MERGE_GAP
+#define AVI_DMUX_HINT_MERGE_GAP (4 * 1024)
+#endif
+
+// Read-ahead of the buffered reader, by duration at the file's data rate
+#ifndef AVI_DMUX_READ_AHEAD_SEC
+#define AVI_DMUX_READ_AHEAD_SEC 2
+#endif
+#ifndef AVI_DMUX_LOW_WATERMARK_MS
+#define AVI_DMUX_LOW_WATERMARK_MS 500
+#endif
+#ifndef AVI_DMUX_PRELOAD_BOOST_PRIORITY
+#define AVI_DMUX_PRELOAD_BOOST_PRIORITY 9  // Above the AVI playback task
+#endif
+#ifndef AVI_DMUX_DIRECT_IO
+#define AVI_DMUX_DIRECT_IO 0  // O_DIRECT preload reads (br_config_t.direct_io), host only
+#endif
+#ifndef AVI_DMUX_MIN_CHUNK_NUM
+#define AVI_DMUX_MIN_CHUNK_NUM 8
+#endif
+#ifndef AVI_DMUX_MAX_CHUNK_NUM
+#define AVI_DMUX_MAX_CHUNK_NUM 64
 #endif
 
 inline static avi_dmux_video_codec_t fourcc_to_video_codec(fourcc_t fourcc) {
@@ -113,6 +223,11 @@ inline static avi_dmux_video_codec_t fourcc_to_video_codec(fourcc_t fourcc) {
     }
 }
 
+// Every frame of these codecs decodes on its own, whatever the keyframe flags of the index say
+inline static bool video_codec_is_intra_only(avi_dmux_video_codec_t codec) {
+    return codec == AVI_DMUX_VIDEO_CODEC_MJPEG;
+}
+
 inline static avi_dmux_audio_codec_t format_tag_to_audio_codec(uint16_t format_tag) {
     switch (format_tag) {
         case 0x0001: // PCM
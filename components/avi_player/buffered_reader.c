@@ -6,101 +6,278 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <assert.h>
-#include "esp_log.h"
-#include "esp_heap_caps.h"
-#include "freertos/idf_additions.h"
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "os_port.h"
 
+#ifdef ESP_PLATFORM
+#include "esp_log.h"
 static const char *TAG = "buffered_reader";
 #define LOG_ERROR(fmt, ...) ESP_LOGE(TAG, fmt, ##__VA_ARGS__)
 #define LOG_INFO(fmt, ...) ESP_LOGI(TAG, fmt, ##__VA_ARGS__)
 #define LOG_DEBUG(fmt, ...)
 // #define LOG_DEBUG(fmt, ...) printf("[BR] " fmt "\n", ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...) printf("\e[31mE: [BR] "fmt"\e[m\n", ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) printf("I: [BR] "fmt"\n", ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...)
+#endif
 
-static void *memory_allocate(size_t size) { return heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_CACHE_ALIGNED); }
-static void memory_free(void *ptr) { return heap_caps_free(ptr); }
+static void *memory_allocate(size_t size) { return os_buffer_allocate(size); }
+static void memory_free(void *ptr) { return os_buffer_free(ptr); }
 
 typedef enum {
     BR_EVENT_ACTIVE = 1 << 0,
     BR_EVENT_STOP   = 1 << 1,
-    BR_EVENT_MAX    = 1 << 2,
+    BR_EVENT_WAKE   = 1 << 2,   // Consumer moved or released chunks, re-evaluate the ring
+    BR_EVENT_FILLED = 1 << 3,   // A chunk was published by the preload task
 } br_event_t;
-#define BR_EVENT_ALL (BR_EVENT_MAX - 1)
 
-#define BR_CHUNK_IDX_UNUSED (UINT32_MAX)
+// Direct I/O: the preload reads bypass the page cache with O_DIRECT, on the host only. The device has
+// no O_DIRECT, and FATFS already reads the whole sectors of the chunk-aligned preload reads straight
+// into the chunks without it.
+
+// After a miss, wait this long for the refill before falling back to another synchronous read
+#define BR_MISS_WAIT_MS 50
+
+// Chunk N of the file always lives in slot N % chunk_num.
+// The slot tag holds N + 1, or BR_TAG_EMPTY while the slot is empty or being filled.
+#define BR_TAG_EMPTY 0
+
+// Single producer (preload task) / single consumer (br_read, br_peek) ring without a lock.
+// The consumer publishes the chunk it is in as `tail`, the producer fills the chunks after it and
+// publishes each one with a release store of its tag. The consumer checks the tag before and after
+// copying, so a slot recycled under it is detected and handled like a miss.
 typedef struct buffered_reader {
     int fd;
-    SemaphoreHandle_t mutex;
-    EventGroupHandle_t event_group;
-    off_t file_size;
-    off_t first_chunk_offset;
-    off_t current_offset;
+    int direct_fd;          // O_DIRECT descriptor for the aligned preload reads, -1 when direct I/O is off
+    os_event_group_t *event_group;
+    uint64_t file_size;
     bool preload_enabled;
-    uint8_t chunk_offset;
-    uint8_t chunk_length;
-    uint8_t *buffer[BR_CHUNK_NUM];
+    size_t chunk_size;
+    int chunk_num;
+    int back_chunk_num;
+    uint8_t *memory;        // All chunks in one contiguous block so that adjacent slots can be filled by one read
+    _Atomic uint32_t tail;          // Consumer: chunk containing current_offset
+    _Atomic uint32_t head;          // Producer: first chunk from tail that is not preloaded yet
+    _Atomic uint32_t *tag;          // Producer, chunk_num entries
+    _Atomic uint32_t *pin_count;    // Consumer (br_peek / br_release), chunk_num entries
+    _Atomic uint32_t data_rate;     // Bytes/sec, 0 while unknown
+    uint32_t read_ahead_ms;
+    uint32_t low_watermark_ms;
+    os_task_t *task;
+    int task_priority;
+    // Set by the consumer with br_hint_ranges / br_set_read_ahead, read by the producer under hint_mutex
+    os_mutex_t *hint_mutex;
+    br_range_t hints[BR_HINT_MAX_RANGES];
+    size_t hint_count;
+    bool read_ahead;        // Preload past the hints, false for random access
+    int boost_priority;
+
+    // Consumer only
+    uint64_t current_offset;
+    bool refill_pending;    // A miss or a far seek moved the ring and the refill is not caught up yet
+    bool boosted;           // The preload task runs at boost_priority
+    br_stats_t stats;
+
+    // Producer only
+    uint32_t preload_read_count;
+    uint64_t bytes_preloaded;
 } buffered_reader_t;
 
+static inline uint32_t br_chunk(buffered_reader_t *reader, uint64_t offset) { return offset / reader->chunk_size; }
+static inline int br_slot(buffered_reader_t *reader, uint32_t chunk) { return chunk % reader->chunk_num; }
+static inline uint8_t *br_buffer(buffered_reader_t *reader, int slot) { return reader->memory + slot * reader->chunk_size; }
+
+// Chunks from tail to keep preloaded for read_ahead_ms, 0 to fill the whole ring
+static uint32_t br_read_ahead_chunks(buffered_reader_t *reader) {
+    uint32_t data_rate = atomic_load_explicit(&reader->data_rate, memory_order_relaxed);
+    if (reader->read_ahead_ms == 0 || data_rate == 0) return 0;
+    uint64_t bytes = (uint64_t)data_rate * reader->read_ahead_ms / 1000;
+    return (bytes + reader->chunk_size - 1) / reader->chunk_size + 1;  // +1 for the chunk being read
+}
+
+// Producer: chunks touched by the hinted ranges, in a snapshot taken once per round
+typedef struct {
+    br_range_t ranges[BR_HINT_MAX_RANGES];
+    size_t count;
+    uint32_t end_chunk;     // Chunk after the last hinted byte
+    bool read_ahead;
+} br_hint_snapshot_t;
+
+static void br_take_hints(buffered_reader_t *reader, br_hint_snapshot_t *hints) {
+    os_mutex_lock(reader->hint_mutex);
+    hints->count = reader->hint_count;
+    memcpy(hints->ranges, reader->hints, hints->count * sizeof(br_range_t));
+    hints->read_ahead = reader->read_ahead;
+    os_mutex_unlock(reader->hint_mutex);
+    if (hints->count == 0) {
+        hints->end_chunk = 0;
+    } else {
+        const br_range_t *last = &hints->ranges[hints->count - 1];
+        hints->end_chunk = br_chunk(reader, last->offset + last->size - 1) + 1;
+    }
+}
+
+// Only chunks between the read position and the end of the hints are skipped when no range touches them.
+// The read-ahead past the hints stays as it is, the consumer will come there after the hinted ranges.
+// Without read-ahead nothing past them is loaded.
+static bool br_is_wanted(buffered_reader_t *reader, const br_hint_snapshot_t *hints, uint32_t tail, uint32_t chunk) {
+    if (chunk == tail) return true;
+    if (chunk >= hints->end_chunk) return hints->read_ahead;
+    uint64_t start = (uint64_t)chunk * reader->chunk_size;
+    uint64_t end = start + reader->chunk_size;
+    for (size_t i = 0; i < hints->count; i++) {
+        const br_range_t *range = &hints->ranges[i];
+        if (range->offset >= end) break;
+        if (range->offset + range->size > start) return true;
+    }
+    return false;
+}
+
+static bool br_has_chunk(buffered_reader_t *reader, uint32_t chunk) {
+    return atomic_load_explicit(&reader->tag[br_slot(reader, chunk)], memory_order_acquire) == chunk + 1;
+}
+
+// Producer: take a slot for refilling unless br_peek has it pinned.
+// The seq_cst store/load pairs with the add/load in br_pin, so at least one side sees the other.
+static bool br_claim_slot(buffered_reader_t *reader, int slot) {
+    uint32_t tag = atomic_load_explicit(&reader->tag[slot], memory_order_relaxed);
+    atomic_store(&reader->tag[slot], BR_TAG_EMPTY);
+    if (atomic_load(&reader->pin_count[slot]) == 0) return true;
+    atomic_store(&reader->tag[slot], tag);
+    return false;
+}
+
 static void br_preload_task(void *args) {
     LOG_INFO("Start Preload Task");
     buffered_reader_t *reader = (buffered_reader_t*)args;
+    bool idle = false;
     while (true) {
-        br_event_t event = xEventGroupWaitBits(reader->event_group, BR_EVENT_ALL, 0, 0, portMAX_DELAY);
+        br_event_t event = os_event_group_wait_bits(reader->event_group, BR_EVENT_ACTIVE | BR_EVENT_STOP, false, OS_WAIT_FOREVER);
         if (event & BR_EVENT_STOP) break;
+        if (idle) {
+            // Ring is full (or blocked by pinned chunks), sleep until the consumer moves
+            event = os_event_group_wait_bits(reader->event_group, BR_EVENT_WAKE | BR_EVENT_STOP, false, OS_WAIT_FOREVER);
+            if (event & BR_EVENT_STOP) break;
+        }
+        os_event_group_clear_bits(reader->event_group, BR_EVENT_WAKE);
+
+        // First chunk from the consumer position that still has to be loaded
+        uint32_t tail = atomic_load_explicit(&reader->tail, memory_order_acquire);
+        br_hint_snapshot_t hints;
+        br_take_hints(reader, &hints);
+        uint32_t end_chunk = reader->file_size > 0 ? br_chunk(reader, reader->file_size - 1) + 1 : 0;
+        // Leave back_chunk_num slots of already read chunks for short rewinds
+        uint32_t want_end = tail + reader->chunk_num - reader->back_chunk_num;
+        uint32_t read_ahead = br_read_ahead_chunks(reader);
+        if (read_ahead > 0 && want_end > tail + read_ahead) want_end = tail + read_ahead;
+        if (want_end > end_chunk) want_end = end_chunk;
+        uint32_t chunk = tail;
+        while (chunk < want_end && (br_has_chunk(reader, chunk) || !br_is_wanted(reader, &hints, tail, chunk))) chunk++;
+        atomic_store_explicit(&reader->head, chunk, memory_order_release);
+        LOG_DEBUG("tail: %u, head: %u, want_end: %u", (unsigned int)tail, (unsigned int)chunk, (unsigned int)want_end);
 
-        xSemaphoreTake(reader->mutex, portMAX_DELAY);
-        off_t current_offset = reader->current_offset;
-        LOG_DEBUG("current_offset: 0x%08lX, first_chunk_offset: 0x%08lX", current_offset, reader->first_chunk_offset);
-        if (current_offset < reader->first_chunk_offset) {
-            reader->chunk_offset = 0;
-            reader->chunk_length = 0;
-            reader->first_chunk_offset = 0;
-        } else if (reader->chunk_length > 0 && reader->first_chunk_offset + BR_CHUNK_SIZE <= current_offset) {
-            LOG_DEBUG("invalidate chunk: 0x%08lX", reader->first_chunk_offset);
-            while (reader->chunk_length > 0 && reader->first_chunk_offset + BR_CHUNK_SIZE <= current_offset) {
-                reader->first_chunk_offset += BR_CHUNK_SIZE;
-                reader->chunk_offset = (reader->chunk_offset + 1) % BR_CHUNK_NUM;
-                reader->chunk_length--;
+        // Coalesce the missing chunks up to the contiguous tail of the ring into one read.
+        // Right after a jump the consumer is waiting for the first chunk, so fetch it alone.
+        int slot = br_slot(reader, chunk);
+        int chunk_count = 0;
+        int max_count = want_end > chunk ? want_end - chunk : 0;
+        if (max_count > reader->chunk_num - slot) max_count = reader->chunk_num - slot;
+        if (chunk == tail && max_count > 1) max_count = 1;
+        // Stop at a chunk that is already loaded or not hinted, or at a slot still borrowed by br_peek
+        // (br_release wakes us)
+        while (chunk_count < max_count && !br_has_chunk(reader, chunk + chunk_count) &&
+               br_is_wanted(reader, &hints, tail, chunk + chunk_count) && br_claim_slot(reader, slot + chunk_count)) {
+            chunk_count++;
+        }
+
+        bool progressed = false;
+        if (chunk_count > 0) {
+            // The claimed slots are invisible to the consumer until their tags are published
+            atomic_thread_fence(memory_order_seq_cst);
+            uint64_t file_offset = (uint64_t)chunk * reader->chunk_size;
+            size_t read_size = chunk_count * reader->chunk_size;
+            if (file_offset + read_size > reader->file_size) read_size = reader->file_size - file_offset;
+            ssize_t result;
+            if (reader->direct_fd >= 0) {
+                // Round the last partial chunk up to whole sectors, the read returns short at the end of file
+                size_t aligned_size = (read_size + BR_DIRECT_IO_ALIGN - 1) & ~(size_t)(BR_DIRECT_IO_ALIGN - 1);
+                result = pread(reader->direct_fd, br_buffer(reader, slot), aligned_size, file_offset);
+                if (result > (ssize_t)read_size) result = read_size;
+            } else {
+                result = pread(reader->fd, br_buffer(reader, slot), read_size, file_offset);
             }
-        } else if (reader->chunk_length < BR_CHUNK_NUM - 1) {
-            int chunk_index;
-            off_t file_offset;
-            if (reader->chunk_length > 0 && reader->first_chunk_offset <= reader->current_offset) {
-                chunk_index = (reader->chunk_offset + reader->chunk_length) % BR_CHUNK_NUM;
-                file_offset = reader->first_chunk_offset + reader->chunk_length * BR_CHUNK_SIZE;
-                LOG_DEBUG("preload first chunk: 0x%08lX, chunk_index=%d", file_offset, chunk_index);
+            reader->preload_read_count++;
+            if (result == (ssize_t)read_size) {
+                for (int i = 0; i < chunk_count; i++) {
+                    atomic_store_explicit(&reader->tag[slot + i], chunk + i + 1, memory_order_release);
+                }
+                atomic_store_explicit(&reader->head, chunk + chunk_count, memory_order_release);
+                reader->bytes_preloaded += result;
+                progressed = true;
+                os_event_group_set_bits(reader->event_group, BR_EVENT_FILLED);
             } else {
-                chunk_index = 0;
-                file_offset = current_offset & ~(BR_CHUNK_SIZE - 1);
-                reader->chunk_offset = 0;
-                reader->first_chunk_offset = file_offset;
-                LOG_DEBUG("preload first chunk: 0x%08lX", file_offset);
+                LOG_ERROR("preload read failed: offset=0x%08llX, result=%d", (unsigned long long)file_offset, (int)result);
             }
-            size_t read_size = file_offset + BR_CHUNK_SIZE <= reader->file_size ? BR_CHUNK_SIZE : reader->file_size - file_offset;
-            lseek(reader->fd, file_offset, SEEK_SET);
-            size_t result = read(reader->fd, reader->buffer[chunk_index], read_size);
-            if (result == read_size) reader->chunk_length++;
         }
-        xSemaphoreGive(reader->mutex);
+        // Keep issuing reads back-to-back up to the high watermark, sleep once there is nothing to load
+        idle = !progressed;
     }
-    vEventGroupDelete(reader->event_group);
+    os_event_group_delete(reader->event_group);
     reader->event_group = NULL;
     LOG_INFO("End Preload Task");
-    vTaskDelete(NULL);
 }
 
 buffered_reader_t *br_open(const char *path) {
-    // Open file
+    br_config_t config = BR_CONFIG_DEFAULT();
+    return br_open_ex(path, &config);
+}
+
+buffered_reader_t *br_open_ex(const char *path, const br_config_t *config) {
     int fd = open(path, O_RDONLY);
-    if (!fd) return NULL;
+    if (fd < 0) return NULL;
+    return br_open_fd(path, fd, config);
+}
+
+buffered_reader_t *br_open_fd(const char *path, int fd, const br_config_t *config) {
+    if (config->chunk_size == 0 || config->chunk_num < 2 || config->chunk_num > BR_CHUNK_NUM_MAX ||
+        config->back_chunk_num < 1 || config->back_chunk_num > config->chunk_num - 1) {
+        LOG_ERROR("Invalid config: chunk_size=%u, chunk_num=%u, back_chunk_num=%u", (unsigned int)config->chunk_size,
+                  (unsigned int)config->chunk_num, (unsigned int)config->back_chunk_num);
+        close(fd);
+        return NULL;
+    }
+
     buffered_reader_t *reader = (buffered_reader_t*)memory_allocate(sizeof(buffered_reader_t));
     reader->fd = fd;
+    reader->direct_fd = -1;
+    if (config->direct_io) {
+        // Chunk offsets and sizes are multiples of the chunk size, so that has to be sector aligned.
+        // Unaligned reads (sync reads on a miss) always go through the normal descriptor.
+        if (config->chunk_size % BR_DIRECT_IO_ALIGN) {
+            LOG_ERROR("Direct I/O needs chunk_size aligned to %d, disabled", BR_DIRECT_IO_ALIGN);
+        } else {
+#ifdef O_DIRECT
+            // O_DIRECT is a property of the descriptor, the aligned reads need their own
+            reader->direct_fd = open(path, O_RDONLY | O_DIRECT);
+            if (reader->direct_fd < 0) LOG_ERROR("Direct I/O not supported for %s, disabled", path);
+#else
+            LOG_ERROR("Direct I/O needs O_DIRECT, disabled");
+#endif
+        }
+    }
+    reader->chunk_size = config->chunk_size;
+    reader->chunk_num = config->chunk_num;
+    reader->back_chunk_num = config->back_chunk_num;
 
-    // Create Mutex / Event Group / Task
-    reader->mutex = xSemaphoreCreateMutex();
-    assert(reader->mutex);
-    reader->event_group = xEventGroupCreate();
+    // Create Event Group / Task
+    reader->event_group = os_event_group_create();
     assert(reader->event_group);
-    xTaskCreatePinnedToCore(br_preload_task, "preload", 4096, reader, 1, NULL, 0);
+    reader->hint_mutex = os_mutex_create();
+    assert(reader->hint_mutex);
+    reader->hint_count = 0;
+    reader->read_ahead = true;
 
     // Get File Size
     struct stat st;
@@ -108,94 +285,283 @@ buffered_reader_t *br_open(const char *path) {
     reader->file_size = st.st_size;
 
     // intialize buffers
-    reader->first_chunk_offset = 0;
     reader->current_offset = 0;
     reader->preload_enabled = false;
-    reader->chunk_offset = 0;
-    reader->chunk_length = 0;
-    for (int i = 0; i < BR_CHUNK_NUM; i++) {
-        reader->buffer[i] = memory_allocate(BR_CHUNK_SIZE);
-        assert(reader->buffer[i]);
+    reader->refill_pending = false;
+    reader->boosted = false;
+    reader->read_ahead_ms = config->read_ahead_ms;
+    reader->low_watermark_ms = config->low_watermark_ms;
+    reader->task_priority = config->task_priority;
+    reader->boost_priority = config->boost_priority;
+    atomic_init(&reader->data_rate, 0);
+    memset(&reader->stats, 0, sizeof(reader->stats));
+    reader->preload_read_count = 0;
+    reader->bytes_preloaded = 0;
+    atomic_init(&reader->tail, 0);
+    atomic_init(&reader->head, 0);
+    reader->memory = os_buffer_allocate_caps(reader->chunk_size * reader->chunk_num, config->memory_caps);
+    assert(reader->memory);
+    reader->tag = malloc(sizeof(*reader->tag) * reader->chunk_num);
+    reader->pin_count = malloc(sizeof(*reader->pin_count) * reader->chunk_num);
+    assert(reader->tag && reader->pin_count);
+    for (int i = 0; i < reader->chunk_num; i++) {
+        atomic_init(&reader->tag[i], BR_TAG_EMPTY);
+        atomic_init(&reader->pin_count[i], 0);
     }
+    LOG_INFO("Chunk ring: %u x %u KB", (unsigned int)reader->chunk_num, (unsigned int)(reader->chunk_size / 1024));
+    if (!os_task_create(br_preload_task, "preload", 4096, reader, config->task_priority, config->task_core, &reader->task)) { assert(false); }
     return reader;
 }
 
 void br_close(buffered_reader_t *reader) {
-    xEventGroupSetBits(reader->event_group, BR_EVENT_STOP);
-    while (reader->event_group) vTaskDelay(pdMS_TO_TICKS(10));
-    vSemaphoreDelete(reader->mutex);
+    os_event_group_set_bits(reader->event_group, BR_EVENT_STOP);
+    while (reader->event_group) os_delay_ms(10);
+    os_mutex_delete(reader->hint_mutex);
     close(reader->fd);
-    for (int i = 0; i < BR_CHUNK_NUM; i++) memory_free(reader->buffer[i]);
+    if (reader->direct_fd >= 0) close(reader->direct_fd);
+    free(reader->tag);
+    free(reader->pin_count);
+    memory_free(reader->memory);
     memory_free(reader);
 }
 
+// Duration of the data preloaded ahead of the read position. Approximate: `head` is only
+// refreshed by the preload task, so it lags right after a jump.
+static uint32_t br_buffered_ms(buffered_reader_t *reader) {
+    uint32_t data_rate = atomic_load_explicit(&reader->data_rate, memory_order_relaxed);
+    if (data_rate == 0) return 0;
+    uint64_t head_offset = (uint64_t)atomic_load_explicit(&reader->head, memory_order_acquire) * reader->chunk_size;
+    if (head_offset > reader->file_size) head_offset = reader->file_size;
+    if (head_offset <= reader->current_offset) return 0;
+    return (uint64_t)(head_offset - reader->current_offset) * 1000 / data_rate;
+}
+
+// Boost the preload task while the buffered data is below the low watermark,
+// so that higher priority tasks (decoder, UI) cannot starve it into an underrun.
+// Without read-ahead there is no buffer to keep up, read_ahead is the consumer's own setting.
+static void br_update_priority(buffered_reader_t *reader) {
+    if (reader->low_watermark_ms == 0 || atomic_load_explicit(&reader->data_rate, memory_order_relaxed) == 0) return;
+    uint64_t head_offset = (uint64_t)atomic_load_explicit(&reader->head, memory_order_relaxed) * reader->chunk_size;
+    bool low = reader->read_ahead && head_offset < reader->file_size && br_buffered_ms(reader) < reader->low_watermark_ms;
+    if (low == reader->boosted) return;
+    reader->boosted = low;
+    if (low) reader->stats.boost_count++;
+    LOG_DEBUG("preload priority: %d", low ? reader->boost_priority : reader->task_priority);
+    os_task_set_priority(reader->task, low ? reader->boost_priority : reader->task_priority);
+}
+
+// Move the read position and wake the preload task when it entered another chunk
+static void br_set_offset(buffered_reader_t *reader, uint64_t offset) {
+    bool moved = br_chunk(reader, reader->current_offset) != br_chunk(reader, offset);
+    reader->current_offset = offset;
+    if (moved) {
+        atomic_store_explicit(&reader->tail, br_chunk(reader, offset), memory_order_release);
+        br_update_priority(reader);
+        os_event_group_set_bits(reader->event_group, BR_EVENT_WAKE);
+    }
+}
+
+static bool br_is_preloaded(buffered_reader_t *reader, uint64_t offset, size_t size) {
+    for (uint32_t chunk = br_chunk(reader, offset); chunk <= br_chunk(reader, offset + size - 1); chunk++) {
+        if (!br_has_chunk(reader, chunk)) return false;
+    }
+    return true;
+}
+
+// Copy out of the preloaded chunks. Fails if a chunk is missing or was recycled during the copy.
+static bool br_copy_preloaded(buffered_reader_t *reader, uint64_t offset, void *buffer, size_t size) {
+    uint8_t *p = (uint8_t*)buffer;
+    while (size > 0) {
+        // チャンクと循環バッファ内のインデックスを計算
+        uint32_t chunk = br_chunk(reader, offset);
+        int slot = br_slot(reader, chunk);
+
+        // このチャンク内での読み取り開始位置とバイト数
+        size_t chunk_offset = offset - (uint64_t)chunk * reader->chunk_size;
+        size_t bytes_to_copy = reader->chunk_size - chunk_offset;
+        if (bytes_to_copy > size) bytes_to_copy = size;
+
+        // データをコピーし、コピー中に差し替えられていないことを確認
+        if (!br_has_chunk(reader, chunk)) return false;
+        memcpy(p, br_buffer(reader, slot) + chunk_offset, bytes_to_copy);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&reader->tag[slot], memory_order_relaxed) != chunk + 1) return false;
+
+        // ポインタと残りバイト数を更新
+        p += bytes_to_copy;
+        offset += bytes_to_copy;
+        size -= bytes_to_copy;
+    }
+    return true;
+}
+
+static void br_add_stall(buffered_reader_t *reader, int64_t start) {
+    uint32_t stall = os_time_us() - start;
+    reader->stats.stall_time_us += stall;
+    if (stall > reader->stats.stall_max_us) reader->stats.stall_max_us = stall;
+}
+
+// A chunk cannot be loaded while its slot is still pinned for an older chunk
+static bool br_is_blocked(buffered_reader_t *reader, uint64_t offset, size_t size) {
+    for (uint32_t chunk = br_chunk(reader, offset); chunk <= br_chunk(reader, offset + size - 1); chunk++) {
+        if (!br_has_chunk(reader, chunk) && atomic_load_explicit(&reader->pin_count[br_slot(reader, chunk)], memory_order_relaxed) > 0) return true;
+    }
+    return false;
+}
+
+// Wait for the refill that a previous miss or far seek started
+static bool br_wait_preloaded(buffered_reader_t *reader, uint64_t offset, size_t size) {
+    if (!reader->refill_pending || br_is_blocked(reader, offset, size)) return false;
+    int64_t deadline = os_time_us() + BR_MISS_WAIT_MS * 1000;
+    while (true) {
+        os_event_group_clear_bits(reader->event_group, BR_EVENT_FILLED);
+        if (br_is_preloaded(reader, offset, size)) return true;
+        int64_t remaining = deadline - os_time_us();
+        if (remaining <= 0) return false;
+        os_event_group_wait_bits(reader->event_group, BR_EVENT_FILLED, true, (remaining + 999) / 1000);
+    }
+}
+
+// Chunk the consumer needs after the one at the read position: the next one, or with hints the first
+// one a hinted range touches (the preload task skips the others, see br_is_wanted). False when nothing
+// more is preloaded, past the hints without read-ahead.
+// The hints are written by the consumer itself, so they are read here without hint_mutex.
+static bool br_next_needed_chunk(buffered_reader_t *reader, uint32_t *needed) {
+    uint32_t chunk = br_chunk(reader, reader->current_offset) + 1;
+    uint32_t end_chunk = 0;
+    if (reader->hint_count > 0) {
+        const br_range_t *last = &reader->hints[reader->hint_count - 1];
+        end_chunk = br_chunk(reader, last->offset + last->size - 1) + 1;
+    }
+    for (size_t i = 0; i < reader->hint_count; i++) {
+        const br_range_t *range = &reader->hints[i];
+        if (br_chunk(reader, range->offset + range->size - 1) < chunk) continue;
+        uint32_t first = br_chunk(reader, range->offset);
+        *needed = first > chunk ? first : chunk;
+        return true;
+    }
+    *needed = end_chunk > chunk ? end_chunk : chunk;
+    return reader->read_ahead;
+}
+
+// The refill after a miss or a far seek is caught up once the next chunk the consumer needs is loaded.
+// Until then a read running into a missing chunk waits for the preload task.
+static void br_refill_caught_up(buffered_reader_t *reader) {
+    uint32_t chunk;
+    if (reader->refill_pending && (!br_next_needed_chunk(reader, &chunk) || br_has_chunk(reader, chunk))) {
+        reader->refill_pending = false;
+    }
+}
+
+// Synchronous read of the missed range. Moving the tail re-anchors the ring at the new position
+// and wakes the preload task to refill it from there.
+static size_t br_read_miss(buffered_reader_t *reader, void *buffer, size_t size) {
+    uint64_t offset = reader->current_offset;
+    ssize_t result = pread(reader->fd, buffer, size, offset);
+    if (result < 0) result = 0;
+    br_set_offset(reader, offset + result);
+    reader->refill_pending = true;
+    reader->stats.miss_count++;
+    reader->stats.bytes_read += result;
+    LOG_INFO("preload miss read: size=0x%08X, offset=0x%08llX, head=0x%08llX", (unsigned int)result, (unsigned long long)offset,
+        (unsigned long long)atomic_load_explicit(&reader->head, memory_order_relaxed) * reader->chunk_size);
+    os_event_group_set_bits(reader->event_group, BR_EVENT_WAKE);
+    return result;
+}
+
 size_t br_read(buffered_reader_t *reader, void *buffer, size_t size) {
+    reader->stats.read_count++;
     if (!reader->preload_enabled) {
         size_t result = read(reader->fd, buffer, size);
         reader->current_offset += result;
+        reader->stats.bytes_read += result;
         return result;
     }
 
-    off_t current_offset = reader->current_offset;
-    off_t first_chunk_offset = reader->first_chunk_offset;
-    off_t last_chunk_offset = first_chunk_offset + BR_CHUNK_SIZE * reader->chunk_length;
+    uint64_t current_offset = reader->current_offset;
+    if (current_offset >= reader->file_size) return 0;
     if (current_offset + size > reader->file_size) size = reader->file_size - current_offset;
-    off_t last_offset = current_offset + size;
-
-    if (current_offset < first_chunk_offset || last_chunk_offset < last_offset) {
-        xSemaphoreTake(reader->mutex, portMAX_DELAY);
-        first_chunk_offset = reader->first_chunk_offset;
-        last_chunk_offset = first_chunk_offset + BR_CHUNK_SIZE * reader->chunk_length;
-        if (current_offset < first_chunk_offset || last_chunk_offset < last_offset) {
-            lseek(reader->fd, reader->current_offset, SEEK_SET);
-            size_t result = read(reader->fd, buffer, size);
-            reader->current_offset += result;
-            LOG_INFO("preload miss read: size=0x%08X, offset=0x%08lX, first_chunk_offset=0x%08lX, chunk_length=%d",
-                result, reader->current_offset, first_chunk_offset, reader->chunk_length);
-            xSemaphoreGive(reader->mutex);
-            vTaskDelay(pdMS_TO_TICKS(5000));
-            LOG_INFO("buffered: first_chunk_offset=0x%08lX, chunk_length=%d", first_chunk_offset, reader->chunk_length);
+    if (size == 0) return 0;
+
+    if (!br_copy_preloaded(reader, current_offset, buffer, size)) {
+        int64_t stall_start = os_time_us();
+        if (!br_wait_preloaded(reader, current_offset, size) || !br_copy_preloaded(reader, current_offset, buffer, size)) {
+            size_t result = br_read_miss(reader, buffer, size);
+            br_add_stall(reader, stall_start);
             return result;
         }
-        xSemaphoreGive(reader->mutex);
+        br_add_stall(reader, stall_start);
     }
+    br_set_offset(reader, current_offset + size);
+    br_refill_caught_up(reader);
+    reader->stats.hit_count++;
+    reader->stats.bytes_copied += size;
+    // LOG_DEBUG("buffer read: size=0x%08X, offset=0x%08lX", size, reader->current_offset);
+    return size;
+}
 
-    uint8_t *p = (uint8_t*)buffer;
-    size_t remaining = size;
-
-    for (int i = 0; i < reader->chunk_length; i++) {
-        // i番目のチャンクの範囲を計算
-        off_t chunk_start = first_chunk_offset + i * BR_CHUNK_SIZE;
-        off_t chunk_end = chunk_start + BR_CHUNK_SIZE;
-
-        // 現在のカーソル位置がこのチャンクの範囲外なら次へ
-        if (current_offset >= chunk_end) continue;
-        if (current_offset + remaining <= chunk_start) break;
+// Consumer: pin a preloaded chunk. The seq_cst add/load pairs with br_claim_slot.
+static bool br_pin(buffered_reader_t *reader, uint32_t chunk) {
+    int slot = br_slot(reader, chunk);
+    atomic_fetch_add(&reader->pin_count[slot], 1);
+    if (atomic_load(&reader->tag[slot]) == chunk + 1) return true;
+    atomic_fetch_sub(&reader->pin_count[slot], 1);
+    return false;
+}
 
-        // 循環バッファ内のインデックスを計算
-        int buffer_index = (reader->chunk_offset + i) % BR_CHUNK_NUM;
+bool br_peek(buffered_reader_t *reader, size_t size, br_span_t *span) {
+    span->segment_count = 0;
+    span->pinned_count = 0;
+    if (!reader->preload_enabled || size == 0) return false;
 
-        // このチャンク内での読み取り開始位置（チャンク先頭からのオフセット）
-        int chunk_offset = (current_offset > chunk_start) ? (current_offset - chunk_start) : 0;
+    uint64_t current_offset = reader->current_offset;
+    uint64_t last_offset = current_offset + size;
+    if (reader->file_size < last_offset) return false;
+    uint32_t first_chunk = br_chunk(reader, current_offset);
+    uint32_t last_chunk = br_chunk(reader, last_offset - 1);
+    if (last_chunk - first_chunk + 1 > BR_SPAN_MAX_SEGMENTS) return false;
 
-        // このチャンクから読み取るバイト数を計算
-        int bytes_to_copy = BR_CHUNK_SIZE - chunk_offset;
-        if (bytes_to_copy > remaining) bytes_to_copy = remaining;
+    // Pin the chunks so that the preload task will not recycle them
+    for (uint32_t chunk = first_chunk; chunk <= last_chunk; chunk++) {
+        if (!br_pin(reader, chunk)) {
+            for (uint32_t pinned = first_chunk; pinned < chunk; pinned++) {
+                atomic_fetch_sub(&reader->pin_count[br_slot(reader, pinned)], 1);
+            }
+            return false;
+        }
+    }
 
-        // データをコピー
-        memcpy(p, &reader->buffer[buffer_index][chunk_offset], bytes_to_copy);
+    size_t remaining = size;
+    for (uint32_t chunk = first_chunk; chunk <= last_chunk; chunk++) {
+        size_t chunk_offset = current_offset - (uint64_t)chunk * reader->chunk_size;
+        size_t bytes = reader->chunk_size - chunk_offset;
+        if (bytes > remaining) bytes = remaining;
+        span->segments[span->segment_count].data = br_buffer(reader, br_slot(reader, chunk)) + chunk_offset;
+        span->segments[span->segment_count].size = bytes;
+        span->segment_count++;
+        current_offset += bytes;
+        remaining -= bytes;
+    }
+    span->pinned_index = br_slot(reader, first_chunk);
+    span->pinned_count = span->segment_count;
+    br_set_offset(reader, current_offset);
+    br_refill_caught_up(reader);
+    reader->stats.read_count++;
+    reader->stats.hit_count++;
+    reader->stats.bytes_borrowed += size;
+    return true;
+}
 
-        // ポインタと残りバイト数を更新
-        p += bytes_to_copy;
-        current_offset += bytes_to_copy;
-        remaining -= bytes_to_copy;
+void br_release(buffered_reader_t *reader, br_span_t *span) {
+    if (span->pinned_count == 0) return;
+    for (int i = 0; i < span->pinned_count; i++) {
+        atomic_fetch_sub(&reader->pin_count[(span->pinned_index + i) % reader->chunk_num], 1);
     }
-    reader->current_offset = current_offset;
-    // LOG_DEBUG("buffer read: size=0x%08X, offset=0x%08lX", size, reader->current_offset);
-    return size;
+    os_event_group_set_bits(reader->event_group, BR_EVENT_WAKE);
+    span->pinned_count = 0;
 }
 
-off_t br_lseek(buffered_reader_t *reader, off_t offset, int whence) {
+int64_t br_lseek(buffered_reader_t *reader, int64_t offset, int whence) {
     if (!reader->preload_enabled) {
         reader->current_offset = lseek(reader->fd, offset, whence);
         return reader->current_offset;
@@ -203,33 +569,75 @@ off_t br_lseek(buffered_reader_t *reader, off_t offset, int whence) {
     // LOG_DEBUG("seek: current=0x%08lX, offset=0x%08lX, whence=%d", reader->current_offset, offset, whence);
     switch (whence) {
     case SEEK_SET:
-        reader->current_offset = offset;
+        br_set_offset(reader, offset);
         break;
     case SEEK_CUR:
-        reader->current_offset += offset;
+        br_set_offset(reader, reader->current_offset + offset);
         break;
     case SEEK_END:
-        reader->current_offset = reader->file_size + offset;
+        br_set_offset(reader, reader->file_size + offset);
         break;
     }
+    if (!reader->refill_pending && reader->current_offset < reader->file_size &&
+        !br_has_chunk(reader, br_chunk(reader, reader->current_offset))) {
+        // Jumped outside the preloaded chunks: the preload task fetches the target chunk first,
+        // and the next read waits for it instead of issuing its own synchronous read
+        reader->refill_pending = true;
+        reader->stats.seek_prefetch_count++;
+        os_event_group_set_bits(reader->event_group, BR_EVENT_WAKE);
+    }
     return reader->current_offset;
 }
 
 void br_set_preload_enable(buffered_reader_t *reader, bool enable) {
     if (enable) {
-        xSemaphoreTake(reader->mutex, portMAX_DELAY);
         reader->current_offset = lseek(reader->fd, 0, SEEK_CUR);
-        xEventGroupSetBits(reader->event_group, BR_EVENT_ACTIVE);
+        atomic_store_explicit(&reader->tail, br_chunk(reader, reader->current_offset), memory_order_release);
         reader->preload_enabled = true;
-        LOG_DEBUG("Prefetch enable: 0x%08lX", reader->current_offset);
-        xSemaphoreGive(reader->mutex);
-        vTaskDelay(pdMS_TO_TICKS(100));
+        // The first reads wait for the refill like after a far seek, instead of a fixed delay
+        reader->refill_pending = true;
+        os_event_group_set_bits(reader->event_group, BR_EVENT_ACTIVE | BR_EVENT_WAKE);
+        LOG_DEBUG("Prefetch enable: 0x%08llX", (unsigned long long)reader->current_offset);
     } else {
-        xSemaphoreTake(reader->mutex, portMAX_DELAY);
         lseek(reader->fd, reader->current_offset, SEEK_SET);
-        xEventGroupClearBits(reader->event_group, BR_EVENT_ACTIVE);
+        os_event_group_clear_bits(reader->event_group, BR_EVENT_ACTIVE);
         reader->preload_enabled = false;
-        LOG_DEBUG("Prefetch disable: 0x%08lX", reader->current_offset);
-        xSemaphoreGive(reader->mutex);
+        LOG_DEBUG("Prefetch disable: 0x%08llX", (unsigned long long)reader->current_offset);
+    }
+}
+
+// The preload counters are read without synchronization, they may lag slightly behind while preloading
+void br_set_data_rate(buffered_reader_t *reader, uint32_t bytes_per_sec) {
+    uint32_t previous = atomic_exchange_explicit(&reader->data_rate, bytes_per_sec, memory_order_relaxed);
+    // Let the preload task pick up a larger read-ahead right away
+    if (bytes_per_sec > previous) os_event_group_set_bits(reader->event_group, BR_EVENT_WAKE);
+}
+
+void br_get_stats(buffered_reader_t *reader, br_stats_t *stats) {
+    *stats = reader->stats;
+    stats->data_rate = atomic_load_explicit(&reader->data_rate, memory_order_relaxed);
+    stats->buffered_ms = br_buffered_ms(reader);
+    stats->preload_read_count = reader->preload_read_count;
+    stats->bytes_preloaded = reader->bytes_preloaded;
+}
+
+void br_hint_ranges(buffered_reader_t *reader, const br_range_t *ranges, size_t count) {
+    os_mutex_lock(reader->hint_mutex);
+    // Empty ranges touch no chunk, and the end of the hints is taken from the last byte of the last one
+    size_t stored = 0;
+    for (size_t i = 0; i < count && stored < BR_HINT_MAX_RANGES; i++) {
+        if (ranges[i].size > 0) reader->hints[stored++] = ranges[i];
     }
+    reader->hint_count = stored;
+    os_mutex_unlock(reader->hint_mutex);
+    os_event_group_set_bits(reader->event_group, BR_EVENT_WAKE);
+}
+
+void br_set_read_ahead(buffered_reader_t *reader, bool enable) {
+    if (enable == reader->read_ahead) return;
+    os_mutex_lock(reader->hint_mutex);
+    reader->read_ahead = enable;
+    os_mutex_unlock(reader->hint_mutex);
+    br_update_priority(reader);
+    os_event_group_set_bits(reader->event_group, BR_EVENT_WAKE);
 }
@@ -1,14 +1,101 @@
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <unistd.h>
 
+// Defaults used by br_open
 #define BR_CHUNK_SIZE  (128 * 1024)
 #define BR_CHUNK_NUM   (32)
+#define BR_CHUNK_NUM_MAX (256)
+#define BR_BACK_CHUNK_NUM (2)
+#define BR_DIRECT_IO_ALIGN (4096)   // Logical block size for O_DIRECT on the host
+#define BR_SPAN_MAX_SEGMENTS (2)
+#define BR_HINT_MAX_RANGES (32)
+
+typedef struct {
+    size_t chunk_size;      // Bytes per chunk (and per read of the preload task at minimum)
+    uint16_t chunk_num;     // Number of chunks in the ring (2 ... BR_CHUNK_NUM_MAX)
+    uint16_t back_chunk_num;    // Chunks behind the read position kept for short rewinds (1 ... chunk_num - 1)
+    uint32_t memory_caps;   // heap_caps flags for the chunk memory (0 = PSRAM, cache aligned)
+    bool direct_io;         // Preload with O_DIRECT, bypassing the page cache (host only, off without O_DIRECT)
+    int task_priority;      // Preload task priority
+    int task_core;          // Preload task core
+    // Read-ahead by duration, effective once the data rate is known (br_set_data_rate).
+    // 0 fills the whole ring.
+    uint32_t read_ahead_ms;     // High watermark: stop preloading with this much data buffered
+    uint32_t low_watermark_ms;  // Below this the preload task runs at boost_priority
+    int boost_priority;
+} br_config_t;
+
+#define BR_CONFIG_DEFAULT() { \
+    .chunk_size = BR_CHUNK_SIZE, \
+    .chunk_num = BR_CHUNK_NUM, \
+    .back_chunk_num = BR_BACK_CHUNK_NUM, \
+    .memory_caps = 0, \
+    .direct_io = false, \
+    .task_priority = 1, \
+    .task_core = 0, \
+    .read_ahead_ms = 0, \
+    .low_watermark_ms = 0, \
+    .boost_priority = 1, \
+}
+
+typedef struct {
+    uint32_t read_count;        // Number of br_read calls
+    uint32_t hit_count;         // Reads served from preloaded chunks
+    uint32_t miss_count;        // Reads that fell back to a synchronous read while preloading
+    uint32_t stall_max_us;      // Longest single stall of br_read on a miss
+    uint64_t stall_time_us;     // Total time br_read spent on misses (sync reads and waiting for refill)
+    uint64_t bytes_copied;      // Bytes copied out of preloaded chunks
+    uint64_t bytes_read;        // Bytes read synchronously from the file
+    uint32_t preload_read_count;    // Number of read calls issued by the preload task
+    uint64_t bytes_preloaded;   // Bytes read by the preload task
+    uint64_t bytes_borrowed;    // Bytes handed out by br_peek without copying
+    uint32_t data_rate;         // Bytes/sec set by br_set_data_rate
+    uint32_t buffered_ms;       // Data preloaded ahead of the read position (approximate)
+    uint32_t boost_count;       // Times the buffered data fell below the low watermark
+    uint32_t seek_prefetch_count;   // Seeks outside the preloaded chunks, fetched first by the preload task
+} br_stats_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+} br_segment_t;
+
+// Borrowed view into the preloaded chunks. The chunks stay pinned until br_release.
+typedef struct {
+    br_segment_t segments[BR_SPAN_MAX_SEGMENTS];
+    uint8_t segment_count;
+    uint8_t pinned_count;   // Number of pinned chunk slots (internal)
+    uint16_t pinned_index;  // First pinned chunk slot (internal)
+} br_span_t;
+
+// Byte range of the file, for br_hint_ranges
+typedef struct {
+    uint64_t offset;
+    size_t size;
+} br_range_t;
 
 typedef struct buffered_reader buffered_reader_t;
 buffered_reader_t *br_open(const char *path);
+buffered_reader_t *br_open_ex(const char *path, const br_config_t *config);
+// br_open_ex on a descriptor of `path` that is already open. The reader takes it over and closes it,
+// also on failure. Others may keep using it for pread while the reader is open.
+buffered_reader_t *br_open_fd(const char *path, int fd, const br_config_t *config);
 void br_close(buffered_reader_t *reader);
 size_t br_read(buffered_reader_t *reader, void *buffer, size_t size);
-off_t br_lseek(buffered_reader_t *reader, off_t offset, int whence);
+int64_t br_lseek(buffered_reader_t *reader, int64_t offset, int whence);
+bool br_peek(buffered_reader_t *reader, size_t size, br_span_t *span);
+void br_release(buffered_reader_t *reader, br_span_t *span);
 void br_set_preload_enable(buffered_reader_t *reader, bool enable);
+// Consumption rate of the file, used to convert read_ahead_ms / low_watermark_ms to bytes
+void br_set_data_rate(buffered_reader_t *reader, uint32_t bytes_per_sec);
+void br_get_stats(buffered_reader_t *reader, br_stats_t *stats);
+// Ranges the consumer reads next, in file order (at most BR_HINT_MAX_RANGES, the rest is dropped).
+// Empty ranges are left out. Up to the end of the last range the preload task skips the chunks no range
+// touches; the read-ahead past them is unchanged. Replaces the previous hints, count 0 clears them.
+void br_hint_ranges(buffered_reader_t *reader, const br_range_t *ranges, size_t count);
+// false: preload only the chunk at the read position and the hinted ranges, nothing past them.
+// For random access (seeking for every frame read). On by default.
+void br_set_read_ahead(buffered_reader_t *reader, bool enable);
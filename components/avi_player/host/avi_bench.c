@@ -0,0 +1,156 @@
+#include "avi_demuxer.h"
+#include "os_port.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#define VIDEO_BUFFER_SIZE (512 * 1024)
+#define AUDIO_BUFFER_SIZE (64 * 1024)
+#define IN_FLIGHT_FRAMES  (2)  // Pinned by AVIPlayer: the frame queued for the JPEG decoder and the one it decodes
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-z] [-r] [-d] [-n max_video_frames] [-s seek_interval] [-c chunk_kb] [-k chunk_num] file.avi\n", prog);
+    fprintf(stderr, "  -z  borrow payloads with avi_dmux_peek_frame instead of copying\n");
+    fprintf(stderr, "  -r  pace the video frames at the file's frame rate, like playback\n");
+    fprintf(stderr, "  -s  seek to a random frame every seek_interval video frames\n");
+    fprintf(stderr, "  -d  preload with O_DIRECT aligned reads (bypasses the page cache)\n");
+    fprintf(stderr, "  -c  -k  override the read-ahead ring (default: sized from the data rate)\n");
+}
+
+int main(int argc, char **argv) {
+    uint32_t max_video_frames = UINT32_MAX;
+    bool zero_copy = false;
+    bool realtime = false;
+    uint32_t seek_interval = 0;
+    br_config_t config = BR_CONFIG_DEFAULT();
+    bool custom_config = false;
+    bool direct_io = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:zrds:c:k:h")) != -1) {
+        switch (opt) {
+        case 'd':
+            direct_io = true;
+            break;
+        case 'c':
+            config.chunk_size = strtoul(optarg, NULL, 0) * 1024;
+            custom_config = true;
+            break;
+        case 'k':
+            config.chunk_num = strtoul(optarg, NULL, 0);
+            custom_config = true;
+            break;
+        case 'z':
+            zero_copy = true;
+            break;
+        case 'r':
+            realtime = true;
+            break;
+        case 's':
+            seek_interval = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            max_video_frames = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *file = argv[optind];
+    // -d alone compares against the same data rate sized ring as the default run
+    if (direct_io && !custom_config) {
+        avi_dmux_reader_config(file, &config);
+        custom_config = true;
+    }
+    if (direct_io) config.direct_io = true;
+
+    int64_t open_start = os_time_us();
+    avi_dmux_t *dmux = avi_dmux_create_ex(file, custom_config ? &config : NULL);
+    if (!dmux) return 1;
+    avi_dmux_info_t *info = avi_dmux_parse_info(dmux);
+    if (!info) {
+        avi_dmux_delete(dmux);
+        return 1;
+    }
+    int64_t open_time = os_time_us() - open_start;
+
+    uint8_t *video_buffer = malloc(VIDEO_BUFFER_SIZE);
+    uint8_t *audio_buffer = malloc(AUDIO_BUFFER_SIZE);
+    if (!video_buffer || !audio_buffer) {
+        fprintf(stderr, "Failed to allocate frame buffers\n");
+        return 1;
+    }
+
+    uint32_t video_frames = 0, audio_frames = 0, seeks = 0;
+    uint64_t video_bytes = 0, audio_bytes = 0;
+    int64_t start = os_time_us();
+    avi_dmux_frame_t frame;
+    br_span_t in_flight[IN_FLIGHT_FRAMES] = {0};
+    while (video_frames < max_video_frames) {
+        if (zero_copy) {
+            // Keep the last video frames pinned like AVIPlayer does until the JPEG decoder is done with them
+            br_span_t *payload = &in_flight[video_frames % IN_FLIGHT_FRAMES];
+            avi_dmux_release_frame(dmux, payload);
+            if (!avi_dmux_peek_frame(dmux, &frame, payload, video_buffer, VIDEO_BUFFER_SIZE, audio_buffer, AUDIO_BUFFER_SIZE)) break;
+            if (frame.type == AVI_DMUX_FRAME_TYPE_AUDIO) avi_dmux_release_frame(dmux, payload);
+        } else if (!avi_dmux_read_frame(dmux, &frame, video_buffer, VIDEO_BUFFER_SIZE, audio_buffer, AUDIO_BUFFER_SIZE)) {
+            break;
+        }
+        if (frame.type == AVI_DMUX_FRAME_TYPE_VIDEO) {
+            if (realtime) {
+                int64_t due = start + (int64_t)video_frames * info->video.frame_rate;
+                int64_t now = os_time_us();
+                if (due > now) os_delay_ms((due - now) / 1000);
+            }
+            video_frames++;
+            video_bytes += frame.size;
+            if (seek_interval && video_frames % seek_interval == 0 && info->video.total_frames > seek_interval) {
+                if (avi_dmux_seek_to_frame(dmux, rand() % (info->video.total_frames - seek_interval))) seeks++;
+            }
+        } else {
+            audio_frames++;
+            audio_bytes += frame.size;
+        }
+    }
+    for (int i = 0; i < IN_FLIGHT_FRAMES; i++) avi_dmux_release_frame(dmux, &in_flight[i]);
+    double elapsed = (os_time_us() - start) / 1000000.0;
+
+    br_stats_t stats;
+    avi_dmux_get_reader_stats(dmux, &stats);
+    uint32_t preload_reads = stats.hit_count + stats.miss_count;
+    double media_sec = video_frames * (info->video.frame_rate / 1000000.0);
+
+    printf("=== avi_bench: %s ===\n", file);
+    printf("Open:              %.1f ms\n", open_time / 1000.0);
+    printf("Demuxed:           %u video / %u audio frames in %.3f sec\n",
+           (unsigned int)video_frames, (unsigned int)audio_frames, elapsed);
+    if (seek_interval) {
+        printf("Seeks:             %u (%u outside the preloaded chunks)\n", (unsigned int)seeks, (unsigned int)stats.seek_prefetch_count);
+    }
+    printf("Video rate:        %.1f frames/sec (%.1fx realtime)\n",
+           video_frames / elapsed, elapsed > 0 ? media_sec / elapsed : 0);
+    printf("Payload:           %.2f MB (%.2f MB/s)\n",
+           (video_bytes + audio_bytes) / (1024.0 * 1024.0), (video_bytes + audio_bytes) / (1024.0 * 1024.0) / elapsed);
+    printf("Bytes copied:      %llu (%.1f per video frame)\n",
+           (unsigned long long)stats.bytes_copied, video_frames ? (double)stats.bytes_copied / video_frames : 0);
+    printf("Bytes borrowed:    %llu\n", (unsigned long long)stats.bytes_borrowed);
+    printf("Bytes read sync:   %llu\n", (unsigned long long)stats.bytes_read);
+    printf("Bytes preloaded:   %llu (%u reads, %.1f KB per read)\n", (unsigned long long)stats.bytes_preloaded,
+           (unsigned int)stats.preload_read_count,
+           stats.preload_read_count ? stats.bytes_preloaded / 1024.0 / stats.preload_read_count : 0);
+    printf("Preload hit ratio: %.2f%% (%u hits, %u misses, %u reads)\n",
+           preload_reads ? stats.hit_count * 100.0 / preload_reads : 0,
+           (unsigned int)stats.hit_count, (unsigned int)stats.miss_count, (unsigned int)stats.read_count);
+    printf("Miss stall:        %.1f ms total, %.1f ms worst\n", stats.stall_time_us / 1000.0, stats.stall_max_us / 1000.0);
+    printf("Data rate:         %.1f KB/s (%u ms buffered at end, %u boosts below low watermark)\n",
+           stats.data_rate / 1024.0, (unsigned int)stats.buffered_ms, (unsigned int)stats.boost_count);
+
+    free(video_buffer);
+    free(audio_buffer);
+    avi_dmux_delete(dmux);
+    return 0;
+}
@@ -0,0 +1,163 @@
+// Stress tool for the lock-free chunk ring of buffered_reader.
+// Uses tiny chunks so that the consumer (this thread) and the preload task wrap around the ring
+// constantly, while the data of every read and every borrowed span is verified against a
+// generated pattern file.
+#include "buffered_reader.h"
+#include "os_port.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#define IN_FLIGHT_SPANS (4)
+#define CHUNK_SIZE      (4096)
+#define CHUNK_NUM       (16)
+#define MAX_READ_SIZE   (CHUNK_SIZE * 3)
+
+static inline uint8_t pattern(off_t offset) {
+    uint32_t x = (uint32_t)offset * 2654435761u;
+    return (x >> 24) ^ (uint8_t)(offset >> 12);
+}
+
+static bool verify(const uint8_t *data, off_t offset, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] != pattern(offset + i)) {
+            fprintf(stderr, "mismatch at 0x%llX (expected 0x%02X, got 0x%02X)\n",
+                    (unsigned long long)(offset + i), pattern(offset + i), data[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    br_span_t span;
+    off_t offset;
+} held_span_t;
+
+static bool verify_span(const held_span_t *held) {
+    off_t offset = held->offset;
+    for (int i = 0; i < held->span.segment_count; i++) {
+        if (!verify(held->span.segments[i].data, offset, held->span.segments[i].size)) return false;
+        offset += held->span.segments[i].size;
+    }
+    return true;
+}
+
+static bool create_pattern_file(const char *path, off_t size) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return false;
+    uint8_t block[4096];
+    for (off_t offset = 0; offset < size; offset += sizeof(block)) {
+        size_t bytes = size - offset < (off_t)sizeof(block) ? (size_t)(size - offset) : sizeof(block);
+        for (size_t i = 0; i < bytes; i++) block[i] = pattern(offset + i);
+        if (fwrite(block, 1, bytes, fp) != bytes) {
+            fclose(fp);
+            return false;
+        }
+    }
+    return fclose(fp) == 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-i iterations] [-s seed] [-m file_size_kb] [pattern_file]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    uint32_t iterations = 1000000;
+    uint32_t seed = 1;
+    off_t file_size = 4 * 1024 * 1024 + 123;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:s:m:h")) != -1) {
+        switch (opt) {
+        case 'i':
+            iterations = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            file_size = strtoull(optarg, NULL, 0) * 1024 + 123;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    const char *path = optind < argc ? argv[optind] : "/tmp/br_stress.bin";
+    if (!create_pattern_file(path, file_size)) {
+        fprintf(stderr, "Failed to create %s\n", path);
+        return 1;
+    }
+
+    br_config_t config = BR_CONFIG_DEFAULT();
+    config.chunk_size = CHUNK_SIZE;
+    config.chunk_num = CHUNK_NUM;
+    buffered_reader_t *reader = br_open_ex(path, &config);
+    if (!reader) return 1;
+    br_set_preload_enable(reader, true);
+    srand(seed);
+
+    uint8_t *buffer = malloc(MAX_READ_SIZE);
+    held_span_t held[IN_FLIGHT_SPANS] = {0};
+    uint32_t errors = 0, peeks = 0, seeks = 0;
+    int64_t start = os_time_us();
+    for (uint32_t i = 0; i < iterations && errors == 0; i++) {
+        off_t offset = br_lseek(reader, 0, SEEK_CUR);
+        int op = rand() % 100;
+        if (op < 70) {
+            // Sequential read across chunk boundaries
+            size_t size = 1 + rand() % MAX_READ_SIZE;
+            size_t expected = offset + (off_t)size > file_size ? (size_t)(file_size - offset) : size;
+            size_t result = br_read(reader, buffer, size);
+            if (result != expected || !verify(buffer, offset, result)) errors++;
+            if (result == 0) br_lseek(reader, 0, SEEK_SET);
+        } else if (op < 85) {
+            // Borrow a span and keep it pinned while the preload task keeps running
+            held_span_t *slot = &held[peeks % IN_FLIGHT_SPANS];
+            if (slot->span.pinned_count > 0 && !verify_span(slot)) errors++;
+            br_release(reader, &slot->span);
+            size_t size = 1 + rand() % CHUNK_SIZE;
+            slot->offset = offset;
+            if (br_peek(reader, size, &slot->span)) {
+                peeks++;
+                if (!verify_span(slot)) errors++;
+            } else if (offset + (off_t)size <= file_size) {
+                // Not preloaded yet, fall back to a copy like the demuxer does
+                if (br_read(reader, buffer, size) != size || !verify(buffer, offset, size)) errors++;
+            } else {
+                br_lseek(reader, 0, SEEK_SET);
+            }
+        } else if (op < 95) {
+            // Short jump back or forward, mostly inside the ring
+            off_t delta = (off_t)(rand() % (CHUNK_SIZE * CHUNK_NUM)) - CHUNK_SIZE * CHUNK_NUM / 2;
+            off_t target = offset + delta;
+            if (target < 0) target = 0;
+            if (target > file_size) target = file_size;
+            br_lseek(reader, target, SEEK_SET);
+            seeks++;
+        } else {
+            // Far jump
+            br_lseek(reader, rand() % file_size, SEEK_SET);
+            seeks++;
+        }
+    }
+    for (int i = 0; i < IN_FLIGHT_SPANS; i++) {
+        if (held[i].span.pinned_count > 0 && !verify_span(&held[i])) errors++;
+        br_release(reader, &held[i].span);
+    }
+    double elapsed = (os_time_us() - start) / 1000000.0;
+
+    br_stats_t stats;
+    br_get_stats(reader, &stats);
+    printf("=== br_stress: %u iterations, chunk %d x %d ===\n", (unsigned int)iterations, CHUNK_SIZE, CHUNK_NUM);
+    printf("Elapsed:           %.3f sec\n", elapsed);
+    printf("Peeks / seeks:     %u / %u\n", (unsigned int)peeks, (unsigned int)seeks);
+    printf("Hits / misses:     %u / %u\n", (unsigned int)stats.hit_count, (unsigned int)stats.miss_count);
+    printf("Preload reads:     %u (%llu bytes)\n", (unsigned int)stats.preload_read_count, (unsigned long long)stats.bytes_preloaded);
+    printf("Result:            %s\n", errors ? "FAILED" : "OK");
+
+    free(buffer);
+    br_close(reader);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,191 @@
+#include "os_port.h"
+#include <stdlib.h>
+
+typedef struct {
+    void (*entry)(void *arg);
+    void *arg;
+} os_task_context_t;
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+
+static TickType_t timeout_to_ticks(uint32_t timeout_ms) {
+    return timeout_ms == OS_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+}
+
+os_mutex_t *os_mutex_create(void) { return (os_mutex_t*)xSemaphoreCreateMutex(); }
+void os_mutex_delete(os_mutex_t *mutex) { vSemaphoreDelete((SemaphoreHandle_t)mutex); }
+void os_mutex_lock(os_mutex_t *mutex) { xSemaphoreTake((SemaphoreHandle_t)mutex, portMAX_DELAY); }
+void os_mutex_unlock(os_mutex_t *mutex) { xSemaphoreGive((SemaphoreHandle_t)mutex); }
+
+os_event_group_t *os_event_group_create(void) { return (os_event_group_t*)xEventGroupCreate(); }
+void os_event_group_delete(os_event_group_t *group) { vEventGroupDelete((EventGroupHandle_t)group); }
+void os_event_group_set_bits(os_event_group_t *group, uint32_t bits) { xEventGroupSetBits((EventGroupHandle_t)group, bits); }
+uint32_t os_event_group_clear_bits(os_event_group_t *group, uint32_t bits) { return xEventGroupClearBits((EventGroupHandle_t)group, bits); }
+uint32_t os_event_group_wait_bits(os_event_group_t *group, uint32_t bits, bool clear_on_exit, uint32_t timeout_ms) {
+    return xEventGroupWaitBits((EventGroupHandle_t)group, bits, clear_on_exit, pdFALSE, timeout_to_ticks(timeout_ms));
+}
+
+static void task_entry(void *arg) {
+    os_task_context_t context = *(os_task_context_t*)arg;
+    free(arg);
+    context.entry(context.arg);
+    vTaskDelete(NULL);
+}
+
+bool os_task_create(void (*entry)(void *arg), const char *name, uint32_t stack_size, void *arg, int priority, int core, os_task_t **task) {
+    os_task_context_t *context = malloc(sizeof(os_task_context_t));
+    if (!context) return false;
+    context->entry = entry;
+    context->arg = arg;
+    TaskHandle_t handle;
+    if (xTaskCreatePinnedToCore(task_entry, name, stack_size, context, priority, &handle, core) != pdPASS) {
+        free(context);
+        return false;
+    }
+    if (task) *task = (os_task_t*)handle;
+    return true;
+}
+
+void os_task_set_priority(os_task_t *task, int priority) {
+    if (task) vTaskPrioritySet((TaskHandle_t)task, priority);
+}
+
+void os_delay_ms(uint32_t ms) { vTaskDelay(pdMS_TO_TICKS(ms)); }
+int64_t os_time_us(void) { return esp_timer_get_time(); }
+
+void *os_buffer_allocate(size_t size) { return os_buffer_allocate_caps(size, 0); }
+void *os_buffer_allocate_caps(size_t size, uint32_t caps) {
+    return heap_caps_malloc(size, caps ? caps : MALLOC_CAP_SPIRAM | MALLOC_CAP_CACHE_ALIGNED);
+}
+void os_buffer_free(void *ptr) { heap_caps_free(ptr); }
+
+#else
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define OS_BUFFER_ALIGNMENT 4096  // Page aligned so that buffers can be used for O_DIRECT reads
+
+struct os_mutex {
+    pthread_mutex_t mutex;
+};
+
+struct os_event_group {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t bits;
+};
+
+os_mutex_t *os_mutex_create(void) {
+    os_mutex_t *mutex = malloc(sizeof(os_mutex_t));
+    if (mutex) pthread_mutex_init(&mutex->mutex, NULL);
+    return mutex;
+}
+void os_mutex_delete(os_mutex_t *mutex) {
+    pthread_mutex_destroy(&mutex->mutex);
+    free(mutex);
+}
+void os_mutex_lock(os_mutex_t *mutex) { pthread_mutex_lock(&mutex->mutex); }
+void os_mutex_unlock(os_mutex_t *mutex) { pthread_mutex_unlock(&mutex->mutex); }
+
+os_event_group_t *os_event_group_create(void) {
+    os_event_group_t *group = malloc(sizeof(os_event_group_t));
+    if (!group) return NULL;
+    pthread_mutex_init(&group->mutex, NULL);
+    pthread_cond_init(&group->cond, NULL);
+    group->bits = 0;
+    return group;
+}
+void os_event_group_delete(os_event_group_t *group) {
+    pthread_cond_destroy(&group->cond);
+    pthread_mutex_destroy(&group->mutex);
+    free(group);
+}
+void os_event_group_set_bits(os_event_group_t *group, uint32_t bits) {
+    pthread_mutex_lock(&group->mutex);
+    group->bits |= bits;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->mutex);
+}
+uint32_t os_event_group_clear_bits(os_event_group_t *group, uint32_t bits) {
+    pthread_mutex_lock(&group->mutex);
+    uint32_t result = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->mutex);
+    return result;
+}
+uint32_t os_event_group_wait_bits(os_event_group_t *group, uint32_t bits, bool clear_on_exit, uint32_t timeout_ms) {
+    struct timespec deadline;
+    if (timeout_ms != OS_WAIT_FOREVER) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    pthread_mutex_lock(&group->mutex);
+    while (!(group->bits & bits)) {
+        if (timeout_ms == OS_WAIT_FOREVER) {
+            pthread_cond_wait(&group->cond, &group->mutex);
+        } else if (pthread_cond_timedwait(&group->cond, &group->mutex, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    uint32_t result = group->bits;
+    if (clear_on_exit) group->bits &= ~bits;
+    pthread_mutex_unlock(&group->mutex);
+    return result;
+}
+
+static void *task_entry(void *arg) {
+    os_task_context_t context = *(os_task_context_t*)arg;
+    free(arg);
+    context.entry(context.arg);
+    return NULL;
+}
+
+bool os_task_create(void (*entry)(void *arg), const char *name, uint32_t stack_size, void *arg, int priority, int core, os_task_t **task) {
+    (void)name; (void)stack_size; (void)priority; (void)core;
+    if (task) *task = NULL;
+    os_task_context_t *context = malloc(sizeof(os_task_context_t));
+    if (!context) return false;
+    context->entry = entry;
+    context->arg = arg;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, task_entry, context)) {
+        free(context);
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+void os_task_set_priority(os_task_t *task, int priority) { (void)task; (void)priority; }
+
+void os_delay_ms(uint32_t ms) {
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) && errno == EINTR);
+}
+
+int64_t os_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void *os_buffer_allocate(size_t size) { return os_buffer_allocate_caps(size, 0); }
+void *os_buffer_allocate_caps(size_t size, uint32_t caps) {
+    (void)caps;
+    return aligned_alloc(OS_BUFFER_ALIGNMENT, (size + OS_BUFFER_ALIGNMENT - 1) & ~(size_t)(OS_BUFFER_ALIGNMENT - 1));
+}
+void os_buffer_free(void *ptr) { free(ptr); }
+
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Thin OS abstraction used by the avi_player component.
+// FreeRTOS / esp_heap_caps on ESP_PLATFORM, pthreads / malloc on the host.
+
+#define OS_WAIT_FOREVER UINT32_MAX
+
+// Mutex
+typedef struct os_mutex os_mutex_t;
+os_mutex_t *os_mutex_create(void);
+void os_mutex_delete(os_mutex_t *mutex);
+void os_mutex_lock(os_mutex_t *mutex);
+void os_mutex_unlock(os_mutex_t *mutex);
+
+// Event Group
+typedef struct os_event_group os_event_group_t;
+os_event_group_t *os_event_group_create(void);
+void os_event_group_delete(os_event_group_t *group);
+void os_event_group_set_bits(os_event_group_t *group, uint32_t bits);
+// Returns the bits before clearing.
+uint32_t os_event_group_clear_bits(os_event_group_t *group, uint32_t bits);
+// Wait until any of `bits` is set. Returns the bits at the time of return.
+uint32_t os_event_group_wait_bits(os_event_group_t *group, uint32_t bits, bool clear_on_exit, uint32_t timeout_ms);
+
+// Task
+// The task ends when `entry` returns. `task` (optional) receives a handle valid until then.
+typedef struct os_task os_task_t;
+bool os_task_create(void (*entry)(void *arg), const char *name, uint32_t stack_size, void *arg, int priority, int core, os_task_t **task);
+// No-op on the host (changing pthread priorities needs privileges)
+void os_task_set_priority(os_task_t *task, int priority);
+void os_delay_ms(uint32_t ms);
+int64_t os_time_us(void);
+
+// Memory for large data buffers (PSRAM, cache aligned)
+void *os_buffer_allocate(size_t size);
+// Same with explicit heap_caps flags (0 = PSRAM, cache aligned). The caps are ignored on the host.
+void *os_buffer_allocate_caps(size_t size, uint32_t caps);
+void os_buffer_free(void *ptr);
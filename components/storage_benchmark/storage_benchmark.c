@@ -73,3 +73,73 @@ void storage_benchmark(const char *file, int block_size, void (*output)(const ch
     heap_caps_free(buffer);
     close(fd);
 }
+
+// ファイル内の位置ごとの読み取り速度を計測 (FATFSのクラスタチェーン探索のコストを比較)
+#define POSITION_READ_SIZE (16 * 1024 * 1024)
+#define POSITION_COUNT 5
+
+static void position_sweep(const char *file, int flags, const char *label, uint8_t *buffer, int block_size,
+                           void (*output)(const char *str, void *user_info), void *user_info) {
+    // fast seek が有効ならオープン時にクラスタリンクマップを作るため、オープンも計測する
+    struct timeval open_start, open_end;
+    gettimeofday(&open_start, NULL);
+    int fd = open(file, flags);
+    gettimeofday(&open_end, NULL);
+    if (fd < 0) {
+        output("Failed to open file", user_info);
+        return;
+    }
+    long open_usec = (open_end.tv_sec - open_start.tv_sec) * 1000000L + (open_end.tv_usec - open_start.tv_usec);
+    off_t file_size = lseek(fd, 0, SEEK_END);
+
+    char msg[256];
+    snprintf(msg, sizeof(msg), "Position sweep %s: file=%s, size=%lld MB, block_size=%d, open %.1f ms",
+             label, file, (long long)(file_size / (1024 * 1024)), block_size, open_usec / 1000.0);
+    output(msg, user_info);
+
+    for (int i = 0; i < POSITION_COUNT; i++) {
+        // 先頭から末尾まで等間隔の位置 (最後はファイル末尾の手前)
+        off_t offset = 0;
+        if (file_size > POSITION_READ_SIZE) {
+            offset = (file_size - POSITION_READ_SIZE) / (POSITION_COUNT - 1) * i;
+            offset &= ~(off_t)(block_size - 1);
+        }
+
+        // シーク直後の最初の読み取りにクラスタチェーンの探索時間が含まれる
+        struct timeval start, first, end;
+        gettimeofday(&start, NULL);
+        lseek(fd, offset, SEEK_SET);
+        ssize_t bytes_read = read(fd, buffer, block_size);
+        gettimeofday(&first, NULL);
+        size_t total_bytes = bytes_read > 0 ? bytes_read : 0;
+        while (total_bytes < POSITION_READ_SIZE && (bytes_read = read(fd, buffer, block_size)) > 0) {
+            total_bytes += bytes_read;
+        }
+        gettimeofday(&end, NULL);
+
+        long first_usec = (first.tv_sec - start.tv_sec) * 1000000L + (first.tv_usec - start.tv_usec);
+        long elapsed_usec = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec);
+        double speed_mbps = (total_bytes / (1024.0 * 1024.0)) / (elapsed_usec / 1000000.0);
+        snprintf(msg, sizeof(msg), "@%lld MB: %.2f MB/s, first read %.1f ms",
+                 (long long)(offset / (1024 * 1024)), speed_mbps, first_usec / 1000.0);
+        output(msg, user_info);
+    }
+    close(fd);
+}
+
+void storage_benchmark_positions(const char *file, int block_size, void (*output)(const char *str, void *user_info), void *user_info) {
+    // バッファを確保
+    uint8_t *buffer = (uint8_t *)heap_caps_malloc(block_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_CACHE_ALIGNED);
+    if (buffer == NULL) {
+        output("Failed to allocate buffer", user_info);
+        return;
+    }
+
+    // FAT VFS は読み取り専用のオープンにだけリンクマップを作る (CONFIG_FATFS_USE_FASTSEEK)。
+    // 読み書きでオープンすると同じファームウェアでリンクマップなしと比較できる (書き込みはしない)
+    position_sweep(file, O_RDWR, "without link map", buffer, block_size, output, user_info);
+    position_sweep(file, O_RDONLY, "with link map", buffer, block_size, output, user_info);
+
+    // クリーンアップ
+    heap_caps_free(buffer);
+}
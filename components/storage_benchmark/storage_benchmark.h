@@ -1,2 +1,5 @@
 #pragma once
 void storage_benchmark(const char *file, int block_size, void (*output)(const char *str, void *user_info), void *user_info);
+// Read speed at the beginning ... end of the file (cost of seeking far into a large file), opened without
+// and with the FATFS fast-seek link map
+void storage_benchmark_positions(const char *file, int block_size, void (*output)(const char *str, void *user_info), void *user_info);
@@ -33,9 +33,56 @@ fileprivate struct AVIDemuxer {
         return result ? frame : nil
     }
 
+    func peekFrame(
+        videoBuffer: UnsafeMutableBufferPointer<UInt8>,
+        audioBuffer: UnsafeMutableBufferPointer<UInt8>,
+    ) -> (frame: avi_dmux_frame_t, payload: br_span_t)? {
+        var frame = avi_dmux_frame_t()
+        var payload = br_span_t()
+        let result = avi_dmux_peek_frame(
+            dmux, &frame, &payload,
+            videoBuffer.baseAddress, UInt32(videoBuffer.count),
+            audioBuffer.baseAddress, UInt32(audioBuffer.count)
+        )
+        return result ? (frame: frame, payload: payload) : nil
+    }
+
+    func releaseFrame(payload: inout br_span_t) {
+        avi_dmux_release_frame(dmux, &payload)
+    }
+
     func seekToStart() {
         avi_dmux_seek_to_start(dmux)
     }
+
+    func setFrameDrop(_ interval: Int) -> Bool {
+        avi_dmux_set_frame_drop(dmux, UInt32(interval))
+    }
+
+    func seek(toTime us: UInt64) -> Bool {
+        avi_dmux_seek_to_time(dmux, us)
+    }
+
+    func seek(toFrame number: Int) -> Bool {
+        guard let frame = UInt32(exactly: number) else { return false }
+        return avi_dmux_seek_to_frame(dmux, frame)
+    }
+
+    // Video frames indexed so far, and whether the index build has ended
+    func indexProgress() -> (done: Bool, frames: Int) {
+        guard let dmux else { return (done: true, frames: 0) }
+        var frames: UInt32 = 0
+        let done = avi_dmux_get_index_progress(dmux, &frames)
+        return (done: done, frames: Int(frames))
+    }
+
+    func setFrameStep(_ step: Int) {
+        avi_dmux_set_frame_step(dmux, Int32(step))
+    }
+
+    func setScrub(_ enable: Bool) {
+        avi_dmux_set_scrub(dmux, enable)
+    }
 }
 
 final class AVIPlayer {
@@ -45,10 +92,26 @@ final class AVIPlayer {
     let jpegBuffer = [UnsafeMutableBufferPointer<UInt8>]((0..<8).map({ _ in
         Memory.allocate(type: UInt8.self, capacity: 512 * 1024, capability: .spiram)!
     }))
+    var jpegPayload = [br_span_t?](repeating: nil, count: 8) // borrowed from reader, released once decoded
+    private var jpegPayloadQueuedAt = [Int](repeating: 0, count: 8) // DisplayMultiplexer.jpegFramesReceived when drawn
     let audioBuffer = Memory.allocate(type: UInt8.self, capacity: 64 * 1024, capability: .spiram)!
     var frameCount = 0
+    private var skippedFrames = 0 // their frame ticks are still due
+    private var frameDrop = 1 // every frameDrop-th frame is read, grows while the decoder falls behind
+    private var frameDropOnTime = 0
+    private var currentFrame = 0 // last video frame handed to the decoder
+    private var framesPerSecond = 1
     var info: avi_dmux_info_t?
+    // Video frames to seek among: the indexed ones once the index is built, since avih of an unfinished
+    // or truncated recording has no count or a wrong one. The header's count until then.
+    var totalFrames: Int {
+        let progress = dmux.indexProgress()
+        if progress.done { return progress.frames }
+        return max(Int(info?.video.total_frames ?? 0), progress.frames)
+    }
     var stateChangedCallback: ((State) -> ())?
+    var trickSpeedChangedCallback: ((Int) -> ())?
+    var positionChangedCallback: ((Int) -> ())? // current video frame, about once a second
 
     enum State {
         case play
@@ -60,9 +123,28 @@ final class AVIPlayer {
         didSet { stateChangedCallback?(state) }
     }
 
+    // Trick play speed, negative in reverse and 0 for normal playback. Applied by the AVI task.
+    static let trickSpeeds = [2, 4, 8, 16]
+    private(set) var trickSpeed = 0 {
+        didSet { trickSpeedChangedCallback?(trickSpeed) }
+    }
+    private var requestedTrickSpeed = 0
+    private var trickInterval = 1 // frame ticks between shown frames, grows while the decoder falls behind
+    private var trickTicks = 0
+    private var trickOnTime = 0
+
+    // Scrubbing: the view posts preview frames while the slider is dragged. The AVI task shows only the
+    // latest one and seeks the playback to the frame where the slider is released.
+    private var scrubbing = false
+    private var scrubFrame: Int?
+    private var scrubEndFrame: Int?
+    private var scrubPaused = false // released while paused, the demuxer stays in scrub mode until resumed
+    private var isScrubbing: Bool { scrubbing || scrubEndFrame != nil }
+
     func open(file: String) -> Bool {
         guard let info = dmux.open(file: file) else { return false }
         self.info = info
+        framesPerSecond = max(1_000_000 / Int(max(info.video.frame_rate, 1)), 1)
 
         // setup video scale
         if info.video.width * info.video.height > 1280 * 720 {
@@ -93,6 +175,7 @@ final class AVIPlayer {
         state = .dispose
         while task != nil { Task.delay(10) } // wait task end
         stopTimer()
+        releaseJpegPayloads()
         for b in jpegBuffer { Memory.free(b) }
         Memory.free(audioBuffer)
         dmux.close()
@@ -100,7 +183,17 @@ final class AVIPlayer {
 
     func play() {
         if let info = info {
-            if state == .stop { dmux.seekToStart() }
+            if state == .stop {
+                // The last frame stays pinned while the display may decode it again
+                releaseDecodedPayloads()
+                endTrickPlay()
+                dmux.setScrub(false)
+                scrubPaused = false
+                dmux.seekToStart()
+                skippedFrames = 0
+                currentFrame = 0
+                if frameDrop > 1 && dmux.setFrameDrop(1) { frameDrop = 1 }
+            }
             state = .play
             startTimer(frameRate: UInt64(info.video.frame_rate))
         }
@@ -119,6 +212,25 @@ final class AVIPlayer {
         state = .stop
         stopTimer()
     }
+    func setTrickPlay(speed: Int) {
+        requestedTrickSpeed = speed
+    }
+    func beginScrub() {
+        if state == .play || state == .pause {
+            scrubbing = true
+        }
+    }
+    func scrub(toFrame number: Int) {
+        if scrubbing {
+            scrubFrame = number
+        }
+    }
+    func endScrub(atFrame number: Int) {
+        if scrubbing {
+            scrubEndFrame = number
+            scrubbing = false
+        }
+    }
 
     private struct Events: OptionSet {
         let rawValue: UInt32
@@ -138,7 +250,11 @@ final class AVIPlayer {
     private func taskRoutine() {
         while true {
             switch state {
-            case .play: taskPlay()
+            case .play where isScrubbing, .pause where isScrubbing: taskScrub()
+            case .play:
+                if scrubPaused { resumeAfterScrub() }
+                if requestedTrickSpeed != trickSpeed { changeTrickSpeed() }
+                if trickSpeed == 0 { taskPlay() } else { taskTrickPlay() }
             case .dispose: return
             default: Task.delay(20);
             }
@@ -147,27 +263,243 @@ final class AVIPlayer {
     private func taskPlay() {
         let videoBuffer = jpegBuffer[jpegBufferIndex]
         let audioBuffer = self.audioBuffer
-        guard let frame = self.dmux.readFrame(videoBuffer: videoBuffer, audioBuffer: audioBuffer) else {
+        releaseDecodedPayloads()
+        releaseJpegPayload(index: jpegBufferIndex)
+        guard let result = self.dmux.peekFrame(videoBuffer: videoBuffer, audioBuffer: audioBuffer) else {
             DisplayMultiplexer.showControl = true
             stop()
             return
         }
+        let frame = result.frame
+        var payload = result.payload
+        if frame.type == AVI_DMUX_FRAME_TYPE_VIDEO && frame.decode_only {
+            // Reference frame before a seek target, only inter-frame codecs need it
+            dmux.releaseFrame(payload: &payload)
+            return
+        }
         if frame.type == AVI_DMUX_FRAME_TYPE_VIDEO {
-            while true {
+            // Dropped frames keep their place in time, wait for their ticks as well
+            skippedFrames += Int(frame.dropped_frames)
+            while skippedFrames >= 0 {
                 let event = eventGroup.wait(bits: .frameTimeout, ticksToWait: Task.ticks(20))
-                if event.contains(.frameTimeout) { break }
-                if state != .play { return }
+                if event.contains(.frameTimeout) {
+                    skippedFrames -= 1
+                    continue
+                }
+                if state != .play {
+                    dmux.releaseFrame(payload: &payload)
+                    return
+                }
             }
+            skippedFrames = 0
+            // The decoder has not taken the previous frame yet and this one replaces it
+            let decoderBehind = DisplayMultiplexer.jpegFramePending
+            drawVideoFrame(frame: frame, payload: &payload, buffer: videoBuffer)
+            if frame.size > 0 { updateFrameDrop(decoderBehind: decoderBehind) }
+        }
+        if frame.type == AVI_DMUX_FRAME_TYPE_AUDIO {
             if frame.size > 0 {
-                DisplayMultiplexer.drawJpeg(data: UnsafeRawBufferPointer(videoBuffer))
-                jpegBufferIndex = (jpegBufferIndex + 1) % self.jpegBuffer.count
+                var data = contiguous(payload: &payload, buffer: audioBuffer)
+                if frame.drop_samples > 0, let info, info.audio.codec == AVI_DMUX_AUDIO_CODEC_PCM {
+                    // The first chunk after a seek starts before the target, PCM is cut at the sample.
+                    let bytes = min(Int(frame.drop_samples) * Int(info.audio.block_align), data.count)
+                    data = UnsafeMutableRawBufferPointer(rebasing: data[bytes...])
+                }
+                AudioController.write(data: data)
+            }
+            dmux.releaseFrame(payload: &payload)
+        }
+    }
+
+    // While the decoder falls behind read fewer frames. The demuxer drops the others from the read-ahead
+    // as well, so frames it has not reached yet are not loaded from storage.
+    private func updateFrameDrop(decoderBehind: Bool) {
+        if decoderBehind {
+            if frameDrop < 4 && dmux.setFrameDrop(frameDrop + 1) { frameDrop += 1 }
+            frameDropOnTime = 0
+            return
+        }
+        guard frameDrop > 1 else { return }
+        frameDropOnTime += 1
+        if frameDropOnTime >= 16 && dmux.setFrameDrop(frameDrop - 1) {
+            frameDrop -= 1
+            frameDropOnTime = 0
+        }
+    }
+
+    private func changeTrickSpeed() {
+        let speed = requestedTrickSpeed
+        if speed == 0 {
+            // Back to normal playback from the frame on screen, the seek brings the audio back
+            endTrickPlay()
+            _ = dmux.seek(toFrame: currentFrame + 1)
+            skippedFrames = 0
+            return
+        }
+        if trickSpeed == 0 { trickInterval = 1 }
+        trickTicks = 0
+        trickOnTime = 0
+        dmux.setFrameStep(speed * trickInterval)
+        trickSpeed = speed
+    }
+
+    // Show a frame every trickInterval ticks, `trickSpeed * trickInterval` frames apart, so the position
+    // moves at the trick speed while the display rate follows what the decoder sustains. Every frame is
+    // a seek by the index, audio is muted.
+    private func taskTrickPlay() {
+        let event = eventGroup.wait(bits: .frameTimeout, ticksToWait: Task.ticks(20))
+        guard event.contains(.frameTimeout) else { return }
+        trickTicks += 1
+        if trickTicks < trickInterval { return }
+        if DisplayMultiplexer.jpegFramePending {
+            // The last frame is still queued, show frames less often
+            if trickInterval < 8 {
+                trickInterval += 1
+                dmux.setFrameStep(trickSpeed * trickInterval)
+            }
+            trickOnTime = 0
+            return
+        }
+        trickOnTime += 1
+        if trickOnTime >= 16 && trickInterval > 1 {
+            trickInterval -= 1
+            trickOnTime = 0
+            dmux.setFrameStep(trickSpeed * trickInterval)
+        }
+
+        let lastFrame = totalFrames - 1
+        guard lastFrame >= 0 else {
+            // Nothing to seek to
+            endTrickPlay()
+            return
+        }
+        let target = min(max(currentFrame + trickSpeed * trickTicks, 0), lastFrame)
+        trickTicks = 0
+        if !showFrame(number: target) || (trickSpeed > 0 && target == lastFrame) {
+            endTrickPlay()
+            DisplayMultiplexer.showControl = true
+            stop()
+        } else if target == 0 {
+            // Rewound to the start, play from there
+            endTrickPlay()
+            _ = dmux.seek(toFrame: 0)
+        }
+    }
+    private func endTrickPlay() {
+        dmux.setFrameStep(1)
+        requestedTrickSpeed = 0
+        trickSpeed = 0
+    }
+
+    private func taskScrub() {
+        if trickSpeed != 0 { endTrickPlay() }
+        // Only the frame itself is read, no audio and no read-ahead
+        dmux.setScrub(true)
+        if let number = scrubEndFrame {
+            if state == .pause {
+                // Released while paused: the frame there stays on screen, a pending preview would be dropped
+                if number != currentFrame {
+                    guard !DisplayMultiplexer.jpegFramePending else {
+                        Task.delay(2)
+                        return
+                    }
+                    _ = showFrame(number: number)
+                }
+                scrubEndFrame = nil
+                scrubFrame = nil
+                scrubPaused = true
+                return
             }
-            frameCount += 1
+            // Released, playback goes on from there with audio
+            scrubEndFrame = nil
+            scrubFrame = nil
+            scrubPaused = false
+            dmux.setScrub(false)
+            _ = dmux.seek(toFrame: number)
+            skippedFrames = 0
+            return
         }
-        if frame.type == AVI_DMUX_FRAME_TYPE_AUDIO && frame.size > 0 {
-            AudioController.write(
-                data: UnsafeMutableRawBufferPointer(start: audioBuffer.baseAddress, count: Int(frame.size))
-            )
+        // Read the next preview once the decoder took the last one, the positions in between are dropped
+        guard let number = scrubFrame, !DisplayMultiplexer.jpegFramePending else {
+            Task.delay(2)
+            return
+        }
+        scrubFrame = nil
+        _ = showFrame(number: number)
+    }
+    private func resumeAfterScrub() {
+        // Playback goes on after the frame on screen, the seek brings the audio back
+        scrubPaused = false
+        dmux.setScrub(false)
+        _ = dmux.seek(toFrame: currentFrame + 1)
+        skippedFrames = 0
+    }
+
+    private func showFrame(number: Int) -> Bool {
+        guard dmux.seek(toFrame: number) else { return false }
+        while true {
+            let videoBuffer = jpegBuffer[jpegBufferIndex]
+            releaseDecodedPayloads()
+            releaseJpegPayload(index: jpegBufferIndex)
+            guard let result = dmux.peekFrame(videoBuffer: videoBuffer, audioBuffer: audioBuffer) else { return false }
+            var payload = result.payload
+            if result.frame.type == AVI_DMUX_FRAME_TYPE_VIDEO && !result.frame.decode_only {
+                drawVideoFrame(frame: result.frame, payload: &payload, buffer: videoBuffer)
+                return true
+            }
+            dmux.releaseFrame(payload: &payload)
+        }
+    }
+
+    private func drawVideoFrame(frame: avi_dmux_frame_t, payload: inout br_span_t, buffer: UnsafeMutableBufferPointer<UInt8>) {
+        if frame.size > 0 {
+            // Decode straight from the reader's chunk and keep it pinned until the decoder is done with it.
+            // A frame crossing a chunk boundary is gathered into the buffer since the decoder needs contiguous input.
+            let data = contiguous(payload: &payload, buffer: buffer)
+            if payload.pinned_count > 0 {
+                jpegPayload[jpegBufferIndex] = payload
+                jpegPayloadQueuedAt[jpegBufferIndex] = DisplayMultiplexer.jpegFramesReceived
+            }
+            DisplayMultiplexer.drawJpeg(data: UnsafeRawBufferPointer(data))
+            jpegBufferIndex = (jpegBufferIndex + 1) % self.jpegBuffer.count
+        } else {
+            dmux.releaseFrame(payload: &payload)
+        }
+        currentFrame = Int(frame.frame_index)
+        frameCount += 1
+        if !isScrubbing && frameCount % framesPerSecond == 0 {
+            positionChangedCallback?(currentFrame)
+        }
+    }
+
+    private func contiguous(payload: inout br_span_t, buffer: UnsafeMutableBufferPointer<UInt8>) -> UnsafeMutableRawBufferPointer {
+        if payload.segment_count == 1 {
+            return UnsafeMutableRawBufferPointer(start: UnsafeMutableRawPointer(mutating: payload.segments.0.data), count: payload.segments.0.size)
+        }
+        let dst = UnsafeMutableRawPointer(buffer.baseAddress!)
+        dst.copyMemory(from: payload.segments.0.data, byteCount: payload.segments.0.size)
+        (dst + payload.segments.0.size).copyMemory(from: payload.segments.1.data, byteCount: payload.segments.1.size)
+        let size = payload.segments.0.size + payload.segments.1.size
+        dmux.releaseFrame(payload: &payload)
+        return UnsafeMutableRawBufferPointer(start: dst, count: size)
+    }
+    private func releaseJpegPayload(index: Int) {
+        if var payload = jpegPayload[index] {
+            dmux.releaseFrame(payload: &payload)
+            jpegPayload[index] = nil
+        }
+    }
+    // Only on close, the display may still decode the last frame before that
+    private func releaseJpegPayloads() {
+        for i in 0..<jpegPayload.count { releaseJpegPayload(index: i) }
+    }
+    // Pinned chunks hold back the read-ahead into their slots, hand them back as soon as possible
+    private func releaseDecodedPayloads() {
+        for i in 0..<jpegPayload.count {
+            guard let payload = jpegPayload[i], let data = payload.segments.0.data else { continue }
+            if !DisplayMultiplexer.isJpegInUse(UnsafeRawPointer(data), queuedAt: jpegPayloadQueuedAt[i]) {
+                releaseJpegPayload(index: i)
+            }
         }
     }
 
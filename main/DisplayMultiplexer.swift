@@ -35,7 +35,7 @@ enum DisplayMultiplexer {
                 )
             case .videoPlayer:
                 Config(
-                    uiRegions: [(yOffset: 0, height: 60), (yOffset: size.height - 162, height: 162)],
+                    uiRegions: [(yOffset: 0, height: 60), (yOffset: size.height - 200, height: 200)],
                     canHideControl: true,
                     autoRefresh: false,
                     jpegDecoder: true,
@@ -203,8 +203,24 @@ enum DisplayMultiplexer {
         }
     }
 
+    // A frame is waiting in the queue, the next drawJpeg replaces it before it is shown
+    static private(set) var jpegFramePending = false
+    // Frames taken from the queue, and the input the decoder still reads: the frame it decodes and the
+    // last decoded one, which is decoded again when the controls hide
+    static private(set) var jpegFramesReceived = 0
+    static private var jpegFrameDecoding: UnsafeRawPointer?
+    static private var jpegFrameLast: UnsafeRawPointer?
+
+    // Whether the decoder may still read `data`, queued while jpegFramesReceived was `receivedCount`.
+    // A frame can be taken before it shows up in jpegFrameDecoding, so it counts as in use until the
+    // decoder took two more frames.
+    static func isJpegInUse(_ data: UnsafeRawPointer, queuedAt receivedCount: Int) -> Bool {
+        jpegFramesReceived < receivedCount + 2 || data == jpegFrameDecoding || data == jpegFrameLast
+    }
     static func drawJpeg(data: UnsafeRawBufferPointer) {
-        jpegDecoder?.queue.overwrite(data)
+        guard let jpegDecoder else { return }
+        jpegFramePending = true
+        jpegDecoder.queue.overwrite(data)
     }
     private static func startJpegDecoderTask() {
         let queue = Queue<UnsafeRawBufferPointer>(capacity: 1)!
@@ -219,6 +235,9 @@ enum DisplayMultiplexer {
     private static func stopJpegDecoderTask() {
         jpegDecoder?.shouldStop = true
         while jpegDecoder != nil { Task.delay(1) }
+        jpegFramePending = false
+        jpegFrameDecoding = nil
+        jpegFrameLast = nil
     }
     private static func jpegDecoderTask(queue: Queue<UnsafeRawBufferPointer>) throws(IDF.Error) {
         let decoder = try IDF.JPEG.Decoder(outputFormat: colorSpace == .rgb888 ? .rgb888(elementOrder: .bgr, conversion: .bt601) : .rgb565(elementOrder: .bgr, conversion: .bt601))
@@ -232,6 +251,7 @@ enum DisplayMultiplexer {
         while true {
             if jpegDecoder?.shouldStop == true { return }
             let jpegData: UnsafeRawBufferPointer
+            var received = true
             if showControl {
                 prevControlVisible = true
                 if let recv = queue.receive(timeout: 4) {
@@ -248,6 +268,7 @@ enum DisplayMultiplexer {
                         jpegData = recv
                     } else if let last = lastJpegBuffer {
                         jpegData = last
+                        received = false
                     } else {
                         clear(frameBufferIndex)
                         flush(frameBufferIndex)
@@ -260,6 +281,10 @@ enum DisplayMultiplexer {
                 }
             }
 
+            jpegFrameDecoding = jpegData.baseAddress
+            if received { jpegFramesReceived += 1 }
+            jpegFramePending = false
+
             let nextFrameBufferIndex = (frameBufferIndex + 1) % frameBuffers.count
             let decodeStart = timer.count
             do {
@@ -278,6 +303,7 @@ enum DisplayMultiplexer {
             }
             frameBufferIndex = nextFrameBufferIndex
             lastJpegBuffer = jpegData
+            jpegFrameLast = jpegData.baseAddress
 
             frameCount += 1
             let now = timer.count
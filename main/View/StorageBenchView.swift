@@ -3,6 +3,7 @@ class StorageBenchView {
     let screen: LVGL.Screen
     var fileList: LVGL.Dropdown!
     var bsList: LVGL.Dropdown!
+    var modeList: LVGL.Dropdown!
     var resultView: LVGL.Object!
 
     init() {
@@ -46,6 +47,10 @@ class StorageBenchView {
         bsList.setOptions("All\n" + blockSizes.map({ "\($0)" }).joined(separator: "\n"))
         bsList.setWidth(320)
 
+        modeList = LVGL.Dropdown(parent: optionView)
+        modeList.setOptions("Sequential\nPosition Sweep")
+        modeList.setWidth(320)
+
         let button = LVGL.Button(parent: optionView)
         button.setWidth(320)
         button.addEventCb({
@@ -80,7 +85,8 @@ class StorageBenchView {
             self.println("Invalid Params.")
             return
         }
-        self.bench(file: file, blockSize: bs != 0 ? [bs] : [512, 1024, 2048, 4096, 8192, 16384, 32768, 65536, 131072])
+        let positionSweep = self.modeList.getSelectedStr() == "Position Sweep"
+        self.bench(file: file, blockSize: bs != 0 ? [bs] : [512, 1024, 2048, 4096, 8192, 16384, 32768, 65536, 131072], positionSweep: positionSweep)
     }
 
     private lazy var benchmarkOutput = FFI.Wrapper { (str: UnsafePointer<CChar>) in
@@ -89,13 +95,19 @@ class StorageBenchView {
         print(sstr)
     }
 
-    private func bench(file: String, blockSize: [Int]) {
+    private func bench(file: String, blockSize: [Int], positionSweep: Bool) {
         Task(name: "Benchmark", priority: 15) { _ in
             file.withCString {
                 for bs in blockSize {
-                    storage_benchmark($0, Int32(bs), {
-                        FFI.Wrapper<(UnsafePointer<CChar>) -> ()>.unretained($1)($0!)
-                    }, self.benchmarkOutput.passUnretained())
+                    if positionSweep {
+                        storage_benchmark_positions($0, Int32(bs), {
+                            FFI.Wrapper<(UnsafePointer<CChar>) -> ()>.unretained($1)($0!)
+                        }, self.benchmarkOutput.passUnretained())
+                    } else {
+                        storage_benchmark($0, Int32(bs), {
+                            FFI.Wrapper<(UnsafePointer<CChar>) -> ()>.unretained($1)($0!)
+                        }, self.benchmarkOutput.passUnretained())
+                    }
                     Task.delay(1000)
                 }
             }
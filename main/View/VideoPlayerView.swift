@@ -12,7 +12,10 @@ class VideoPlayerView {
     let screen = LVGL.Screen()
     let player = AVIPlayer()
 
+    var seekSlider: LVGL.Slider!
     var playButtonLabel: LVGL.Image!
+    var rewindButtonLabel: LVGL.Label!
+    var fastForwardButtonLabel: LVGL.Label!
     var slider: LVGL.Slider!
     var sliderLeftIcon: LVGL.Image!
     var sliderRightIcon: LVGL.Image!
@@ -47,6 +50,8 @@ class VideoPlayerView {
         createControlView()
 
         player.stateChangedCallback = { self.stateChanged(state: $0) }
+        player.trickSpeedChangedCallback = { self.trickSpeedChanged(speed: $0) }
+        player.positionChangedCallback = { self.positionChanged(frame: $0) }
     }
 
     func createNavigationBar() {
@@ -77,20 +82,33 @@ class VideoPlayerView {
     func createControlView() {
         let controlView = LVGL.Object(parent: screen)
         controlView.removeStyleAll()
-        controlView.setSize(width: LVGL.percent(100), height: 162)
+        controlView.setSize(width: LVGL.percent(100), height: 200)
         controlView.align(.bottomMid)
         controlView.setStyleBgColor(.black)
         controlView.setStyleBorderWidth(1)
         controlView.setStyleBorderColor(.white)
         controlView.setStyleBorderSide(LV_BORDER_SIDE_TOP)
 
+        let seekView = LVGL.Object(parent: controlView)
+        seekView.removeStyleAll()
+        seekView.setSize(width: 340, height: 30)
+        seekView.align(.topMid, yOffset: 10)
+        seekSlider = LVGL.Slider(parent: seekView)
+        seekSlider.setWidth(300)
+        seekSlider.align(.center)
+        seekSlider.setRange(min: 0, max: 1000)
+        seekSlider.addEventCallback(filter: .pressed, callback: seekSliderPressed)
+        seekSlider.addEventCallback(filter: .valueChanged, callback: seekSliderValueChanged)
+        seekSlider.addEventCallback(filter: LV_EVENT_RELEASED, callback: seekSliderReleased)
+        seekSlider.addEventCallback(filter: LV_EVENT_PRESS_LOST, callback: seekSliderReleased)
+
         let buttonsView = LVGL.Object(parent: controlView)
         buttonsView.removeStyleAll()
         buttonsView.setSize(width: 360, height: 80)
         buttonsView.setFlexFlow(.row)
         buttonsView.setFlexAlign(mainPlace: .center, crossPlace: .center, trackCrossPlace: .center)
         buttonsView.setStylePadColumn(5)
-        buttonsView.align(.topMid, yOffset: 4)
+        buttonsView.alignTo(base: seekView, align: .outBottomMid, yOffset: 4)
         // buttonsView.setStyleBgColor(LVGL.Color(hex: 0x440000))
         // buttonsView.setStyleBgOpa(.cover)
         let addButton = { (size: Int32, icon: UnsafeRawPointer?, callback: FFI.Wrapper<() -> ()>) -> LVGL.Image in
@@ -104,8 +122,21 @@ class VideoPlayerView {
             if let icon = icon { image.setSrc(icon) }
             return image
         }
+        let addTextButton = { (callback: FFI.Wrapper<() -> ()>) -> LVGL.Label in
+            let button = LVGL.Button(parent: buttonsView)
+            button.removeStyleAll()
+            button.setSize(width: 80, height: 80)
+            button.addEventCallback(filter: .clicked, callback: callback)
+            let label = LVGL.Label(parent: button)
+            label.setStyleTextColor(.white)
+            label.center()
+            return label
+        }
+        rewindButtonLabel = addTextButton(rewindButtonPressed)
         playButtonLabel = addButton(80, nil, playButtonPressed)
+        fastForwardButtonLabel = addTextButton(fastForwardButtonPressed)
         stateChanged(state: player.state)
+        trickSpeedChanged(speed: player.trickSpeed)
 
         let sliderView = LVGL.Object(parent: controlView)
         sliderView.removeStyleAll()
@@ -161,12 +192,29 @@ class VideoPlayerView {
 
     private func stateChanged(state: AVIPlayer.State) {
         switch state {
-        case .play : playButtonLabel.setSrc(R.icon.pause_circle)
+        case .play : playButtonLabel.setSrc(player.trickSpeed == 0 ? R.icon.pause_circle : R.icon.play_circle)
         case .pause: playButtonLabel.setSrc(R.icon.play_circle)
         case .stop : playButtonLabel.setSrc(R.icon.play_circle)
         default: break
         }
     }
+    private func positionChanged(frame: Int) {
+        let total = player.totalFrames
+        guard total > 1 else { return }
+        LVGL.withLock { self.seekSlider.setValue(Int32(min(frame, total - 1) * 1000 / (total - 1)), anim: false) }
+    }
+    private func seekSliderFrame() -> Int {
+        let total = player.totalFrames
+        guard total > 1 else { return 0 }
+        return Int(seekSlider.getValue()) * (total - 1) / 1000
+    }
+    private func trickSpeedChanged(speed: Int) {
+        LVGL.withLock {
+            self.rewindButtonLabel.setText(speed < 0 ? "\(LV_SYMBOL_PREV) \(-speed)x" : LV_SYMBOL_PREV)
+            self.fastForwardButtonLabel.setText(speed > 0 ? "\(speed)x \(LV_SYMBOL_NEXT)" : LV_SYMBOL_NEXT)
+            self.stateChanged(state: self.player.state)
+        }
+    }
     private func sliderModeChanged() {
         switch VideoPlayerView.sliderMode {
         case .volume :
@@ -186,7 +234,9 @@ class VideoPlayerView {
         self.close()
     }
     private lazy var playButtonPressed = FFI.Wrapper {
-        if self.player.state == .play {
+        if self.player.state == .play && self.player.trickSpeed != 0 {
+            self.player.setTrickPlay(speed: 0)
+        } else if self.player.state == .play {
             self.player.pause()
         } else if self.player.state == .pause {
             self.player.resume()
@@ -194,6 +244,33 @@ class VideoPlayerView {
             self.player.play()
         }
     }
+    private lazy var rewindButtonPressed = FFI.Wrapper {
+        self.trickButtonPressed(direction: -1)
+    }
+    private lazy var fastForwardButtonPressed = FFI.Wrapper {
+        self.trickButtonPressed(direction: 1)
+    }
+    private func trickButtonPressed(direction: Int) {
+        guard player.state == .play else { return }
+        // Each press takes the next speed in that direction, after the fastest back to normal playback
+        let speeds = AVIPlayer.trickSpeeds
+        let current = player.trickSpeed * direction
+        var speed = speeds[0]
+        if current > 0, let index = speeds.firstIndex(of: current) {
+            speed = index + 1 < speeds.count ? speeds[index + 1] : 0
+        }
+        player.setTrickPlay(speed: speed * direction)
+    }
+    // Dragging shows preview frames, releasing seeks the playback
+    private lazy var seekSliderPressed = FFI.Wrapper {
+        self.player.beginScrub()
+    }
+    private lazy var seekSliderValueChanged = FFI.Wrapper {
+        self.player.scrub(toFrame: self.seekSliderFrame())
+    }
+    private lazy var seekSliderReleased = FFI.Wrapper {
+        self.player.endScrub(atFrame: self.seekSliderFrame())
+    }
     private lazy var sliderModeButtonPressed = FFI.Wrapper {
         switch VideoPlayerView.sliderMode {
         case .volume: VideoPlayerView.sliderMode = .brightness